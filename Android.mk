@@ -49,6 +49,9 @@ LOCAL_SRC_FILES:=\
     lib/bdf-font.cc \
     lib/content-streamer.cc \
     lib/framebuffer.cc \
+    lib/gpio.cc \
+    lib/gpio-backend.cc \
+    lib/gpio-simulated.cc \
     lib/gpio_rk3288.cc \
     lib/graphics.cc \
     lib/hardware-mapping.c \
@@ -57,6 +60,10 @@ LOCAL_SRC_FILES:=\
     lib/multiplex-mappers.cc \
     lib/options-initialize.cc \
     lib/pixel-mapper.cc \
+    lib/register-map.cc \
+    lib/rockchip-mapping.c \
+    lib/rockchip-mapping-spec.cc \
+    lib/rockchip-timing.cc \
     lib/thread.cc \
     examples-api-use/c-example.c\
     examples-api-use/scrolling-text-example.cc\
@@ -70,6 +77,9 @@ LOCAL_SRC_FILES:=\
     test.cc
 
 LOCAL_MODULE_TAGS := optional
+# SELinux usually hides the device tree on Android, so tell the GPIO
+# auto-detection what to expect.
+LOCAL_CFLAGS += -DRGB_DEFAULT_GPIO_BACKEND='"rk3288"'
 LOCAL_CFLAGS +=-W -Wall -Wextra -Wno-unused-parameter -O3 -g -fPIC
 LOCAL_CFLAGS += -fexceptions -D__OPENCV_BUILD=1 -DCVAPI_EXPORTS
 
@@ -59,13 +59,8 @@ int ledcat_main(int argc, char *argv[]) {
       break;
     }
 
-    for (int y = 0; y < canvas->height(); y++) {
-      for (int x = 0; x < canvas->width(); x++) {
-        uint8_t *p = &buf[(y * canvas->width() + x) * 3];
-        uint8_t r = *(p+0), g = *(p+1), b = *(p+2);
-        canvas->SetPixel(x, y, r, g, b);
-      }
-    }
+    canvas->SetPixels(0, 0, canvas->width(), canvas->height(),
+                      buf, canvas->width() * 3, false);
 
     struct timespec end;
     timespec_get(&end, TIME_UTC);
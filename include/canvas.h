@@ -15,6 +15,7 @@
 
 #ifndef RPI_CANVAS_H
 #define RPI_CANVAS_H
+#include <stddef.h>
 #include <stdint.h>
 
 namespace rgb_matrix {
@@ -41,6 +42,21 @@ public:
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue) = 0;
 
+  // Set the "width" x "height" pixels starting at (x,y) from an image with
+  // 24bpp RGB pixels, or BGR if "is_bgr" is true. Rows of the image start
+  // "stride" bytes apart. Does the same as SetPixel() for each pixel, but
+  // canvases might have a faster way to do it.
+  virtual void SetPixels(int x, int y, int width, int height,
+                         const uint8_t *image, size_t stride, bool is_bgr) {
+    for (int row = 0; row < height; ++row) {
+      const uint8_t *pixel = image + row * stride;
+      for (int col = 0; col < width; ++col, pixel += 3) {
+        SetPixel(x + col, y + row,
+                 pixel[is_bgr ? 2 : 0], pixel[1], pixel[is_bgr ? 0 : 2]);
+      }
+    }
+  }
+
   // Clear screen to be all black.
   virtual void Clear() = 0;
 
@@ -83,7 +83,7 @@ struct RGBLedMatrixOptions {
 
   /* Set PWM bits used for output. Default is 11, but if you only deal with
    * limited comic-colors, 1 might be sufficient. Lower require less CPU and
-   * increases refresh-rate.
+   * memory and increases refresh-rate. Up to 15 for very low light levels.
    * Corresponding flag: --led-pwm-bits
    */
   int pwm_bits;
@@ -147,11 +147,17 @@ struct RGBLedMatrixOptions {
   char disable_hardware_pulsing;
   char show_refresh_rate;     /* Corresponding flag: --led-show-refresh    */
   char inverse_colors;        /* Corresponding flag: --led-inverse         */
+  char skip_reclock;          /* Corresponding flag: --led-skip-reclock    */
 
   /* Limit refresh rate of LED panel. This will help on a loaded system
    * to keep a constant refresh rate. <= 0 for no limit.
    */
   int limit_refresh_rate_hz;     /* Corresponding flag: --led-limit-refresh */
+
+  /* A file to keep the calculated pixel mapping in for a faster next start
+   * with the same options.
+   */
+  const char *pixel_mapping_cache;  /* Corresponding flag: --led-pixel-mapping-cache */
 };
 
 /**
@@ -189,6 +195,10 @@ struct RGBLedRuntimeOptions {
   // e.g. you want to just create a stream output (see content-streamer.h),
   // set this to false.
   bool do_gpio_init;
+
+  // Which hardware to talk to: "bcm", "rk3288" or "simulated". NULL or
+  // "auto" detects it.                              Flag: --led-gpio-backend
+  const char *gpio_backend;
 };
 
 /**
@@ -332,9 +342,35 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas);
 
+/**
+ * Like led_matrix_swap_on_vsync(), but does not wait: the canvas is shown
+ * from the next vsync on. Returns a canvas that is not shown to draw the
+ * next frame into (triple buffering).
+ */
+struct LedCanvas *led_matrix_try_swap(struct RGBLedMatrix *matrix,
+                                      struct LedCanvas *canvas);
+
 uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix);
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix, uint8_t brightness);
 
+/**
+ * Brightness in percent applied while refreshing, so unlike
+ * led_matrix_set_brightness() it takes effect without setting pixels again.
+ */
+uint8_t led_matrix_get_refresh_brightness(struct RGBLedMatrix *matrix);
+void led_matrix_set_refresh_brightness(struct RGBLedMatrix *matrix,
+                                       uint8_t brightness);
+
+/**
+ * Replace the pixel mappers of the matrix with the ones in
+ * "pixel_mapper_config", in the same format as in the options. They are
+ * used from the next led_matrix_swap_on_vsync() on, after which the size of
+ * the canvases might be different.
+ * Returns false, not changing anything, if any of them could not be applied.
+ */
+bool led_matrix_set_pixel_mappers(struct RGBLedMatrix *matrix,
+                                  const char *pixel_mapper_config);
+
 // Utility function: set an image from the given buffer containting pixels.
 //
 // Draw image of size "image_width" and "image_height" from pixel at
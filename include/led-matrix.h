@@ -89,7 +89,8 @@ public:
 
     // Set PWM bits used for output. Default is 11, but if you only deal with
     // limited comic-colors, 1 might be sufficient. Lower require less CPU and
-    // increases refresh-rate.
+    // memory and increases refresh-rate. Up to 15 for very low light levels.
+    // SetPWMBits() can not go above this later.
     // Flag: --led-pwm-bits
     int pwm_bits;
 
@@ -128,6 +129,8 @@ public:
     // sound system.
     // This won't do anything if output enable is not connected to GPIO 18 in
     // non-standard wirings.
+    // On Rockchip, this uses synchronous pulses instead of pulses that
+    // overlap with clocking in the next data.
     bool disable_hardware_pulsing;     // Flag: --led-hardware-pulse
 
     // Show refresh rate on the terminal for debugging and tweaking purposes.
@@ -136,6 +139,12 @@ public:
     // Some panels have inversed colors.
     bool inverse_colors;                // Flag: --led-inverse
 
+    // Don't clock in a bitplane of a row if the panels already have the same
+    // data in their shift registers, e.g. for flat colors. Costs a copy of
+    // each bitplane that is clocked in. With show_refresh_rate, the number
+    // of bitplanes saved per frame is shown.
+    bool skip_reclock;                  // Flag: --led-skip-reclock
+
     // In case the internal sequence of mapping is not "RGB", this contains the
     // real mapping. Some panels mix up these colors. String of length three
     // which has to contain all characters R, G and B.
@@ -154,6 +163,11 @@ public:
     // Limit refresh rate of LED panel. This will help on a loaded system
     // to keep a constant refresh rate. <= 0 for no limit.
     int limit_refresh_rate_hz;   // Flag: --led-limit-refresh
+
+    // A file to keep the pixel mapping of the panels, multiplexing and
+    // pixel_mapper_config in, so the next start with the same options does
+    // not have to calculate it. NULL or empty for none.
+    const char *pixel_mapping_cache;  // Flag: --led-pixel-mapping-cache
   };
 
   // Factory to create a matrix. Additional functionality includes dropping
@@ -196,6 +210,8 @@ public:
   virtual int height() const;
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(int x, int y, int width, int height,
+                         const uint8_t *image, size_t stride, bool is_bgr);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
@@ -233,6 +249,15 @@ public:
   // time-correct animations.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // Like SwapOnVSync(), but returns right away instead of waiting for the
+  // VSync: "other" is shown from the next one on, unless another frame is
+  // swapped in before that. Returns a FrameCanvas that is not shown to draw
+  // the next frame into. That is triple buffering; the first call creates
+  // the third FrameCanvas. Returns NULL if "other" is NULL.
+  //
+  // Swap frames from only one thread at a time.
+  FrameCanvas *TrySwap(FrameCanvas *other, unsigned framerate_fraction = 1);
+
   // -- Setting shape and behavior of matrix.
 
   // Apply a pixel mapper. This is used to re-map pixels according to some
@@ -241,6 +266,23 @@ public:
   // Returns a boolean indicating if this was successful.
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
+  // Replace the pixel mappers given in Options::pixel_mapper_config (and
+  // the ones applied with ApplyPixelMapper()) with the ones in
+  // "pixel_mapper_config", in the same format, e.g. "Rotate:90". An empty
+  // string only leaves the mapping of the panels.
+  //
+  // The new mapping is prepared right away in the calling thread, which can
+  // be any thread, while the display keeps running. It takes effect with the
+  // next SwapOnVSync() or TrySwap(): from then on, all FrameCanvases use it
+  // and might have a different width() and height(). So draw the next frame
+  // only after that; the frame passed to that swap is shown as it was drawn.
+  // Drawing in other threads may still use the previous mapping during that
+  // swap, but has to be done by the swap after it.
+  //
+  // Returns false, not changing anything, if any of the mappers could not be
+  // applied.
+  bool SetPixelMappers(const char *pixel_mapper_config);
+
   // Note, there used to be ApplyStaticTransformer(), which has been deprecated
   // since 2018 and changed to a compile-time option, then finally removed
   // in 2020. Use PixelMapper instead, which is simpler and more intuitive.
@@ -249,7 +291,8 @@ public:
   // limited comic-colors, 1 might be sufficient. Lower require less CPU and
   // increases refresh-rate.
   //
-  // Returns boolean to signify if value was within range.
+  // Returns boolean to signify if value was within range, i.e. not more
+  // than Options::pwm_bits.
   //
   // This sets the PWM bits for the current active FrameCanvas and future
   // ones that are created with CreateFrameCanvas().
@@ -265,6 +308,16 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Set brightness in percent of everything shown. 1%..100%.
+  // Unlike SetBrightness(), this does not change the pixels but the time the
+  // LEDs are on, so it takes effect with the next refresh without setting any
+  // pixels again. Both brightnesses combine. Pulses are not made shorter than
+  // Options::pwm_lsb_nanoseconds, so the lower the refresh brightness, the
+  // more of the lowest bitplanes are left out: the darkest shades turn black
+  // and there are fewer shades, as with fewer pwm_bits.
+  void SetRefreshBrightness(uint8_t brightness);
+  uint8_t refresh_brightness();
+
   //-- GPIO interaction.
   // This library uses the GPIO pins to drive the matrix; this is a safe way
   // to request the 'remaining' bits to be used for user purposes.
@@ -337,7 +390,8 @@ public:
   // Set PWM bits used for this Frame.
   // Simple comic-colors, 1 might be sufficient (111 RGB, i.e. 8 colors).
   // Lower require less CPU.
-  // Returns boolean to signify if value was within range.
+  // Returns boolean to signify if value was within range, i.e. not more than
+  // the Options::pwm_bits of the matrix.
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();
 
@@ -377,6 +431,8 @@ public:
   virtual int height() const;
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(int x, int y, int width, int height,
+                         const uint8_t *image, size_t stride, bool is_bgr);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
@@ -425,6 +481,11 @@ struct RuntimeOptions {
   // e.g. you want to just create a stream output (see content-streamer.h),
   // set this to false.
   bool do_gpio_init;
+
+  // Which hardware to talk to: "bcm" (Raspberry Pi), "rk3288" or "simulated"
+  // (no hardware at all, good for benchmarks). NULL or "auto" detects
+  // the hardware we're running on.
+  const char *gpio_backend;  // Default: NULL.       Flag: --led-gpio-backend
 };
 
 // Convenience utility functions to read standard rgb-matrix flags and create
@@ -16,8 +16,11 @@
 #define RPI_RGBMATRIX_FRAMEBUFFER_INTERNAL_H
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #include "hardware-mapping.h"
 
 namespace rgb_matrix {
@@ -25,38 +28,80 @@ class GPIO;
 class PinPulser;
 namespace internal {
 class RowAddressSetter;
+struct ColorLookup;
 
-// An opaque type used within the framebuffer that can be used
-// to copy between PixelMappers.
-struct PixelDesignator {
-  PixelDesignator() : gpio_word(-1), r_bit(0), g_bit(0), b_bit(0), mask(~0u){}
-  long gpio_word;
+// What the bitplanes store for each column. Usually the GPIO word that is
+// clocked out, with the color bits set. With COMPACT_FRAMEBUFFER, only the
+// color bits of up to two parallel chains, which are expanded to GPIO bits
+// while clocking out.
+#ifdef COMPACT_FRAMEBUFFER
+typedef uint16_t plane_bits_t;
+#else
+typedef gpio_bits_t plane_bits_t;
+#endif
+
+// The bits a pixel sets in its word of the bitplanes. There are only a few
+// different ones, e.g. for the upper and lower half of each parallel chain,
+// which all pixels share.
+struct PixelColorBits {
+  PixelColorBits() : r_bit(0), g_bit(0), b_bit(0), mask(~0u) {}
   gpio_bits_t r_bit;
   gpio_bits_t g_bit;
   gpio_bits_t b_bit;
   gpio_bits_t mask;
 };
 
+// An opaque type used within the framebuffer that can be used
+// to copy between PixelMappers.
+struct PixelDesignator {
+  PixelDesignator() : gpio_word(-1), color_class(0) {}
+  int32_t gpio_word;
+  uint32_t color_class;  // Index of its PixelColorBits in the map.
+};
+
 class PixelDesignatorMap {
 public:
-  PixelDesignatorMap(int width, int height, const PixelDesignator &fill_bits);
+  PixelDesignatorMap(int width, int height, const PixelColorBits &fill_bits);
+  // A map for the same Framebuffers as "other", so PixelDesignators can be
+  // copied from it.
+  PixelDesignatorMap(int width, int height, const PixelDesignatorMap &other);
+  PixelDesignatorMap(const PixelDesignatorMap &other);  // A copy.
   ~PixelDesignatorMap();
 
   // Get a writable version of the PixelDesignator. Outside Framebuffer used
   // by the RGBMatrix to re-assign mappings to new PixelDesignatorMappers.
   PixelDesignator *get(int x, int y);
+  const PixelDesignator *get(int x, int y) const;
 
   inline int width() const { return width_; }
   inline int height() const { return height_; }
 
   // All bits that set red/green/blue pixels; used for Fill().
-  const PixelDesignator &GetFillColorBits() { return fill_bits_; }
+  const PixelColorBits &GetFillColorBits() { return fill_bits_; }
+
+  // The color bits of a PixelDesignator of this map.
+  const PixelColorBits &GetColorBits(const PixelDesignator &designator) const {
+    return color_classes_[designator.color_class];
+  }
+  // Returns the color class for "color_bits", adding one if needed.
+  uint32_t GetColorClass(const PixelColorBits &color_bits);
+
+  // A checksum of all PixelDesignators and their color bits.
+  uint64_t Checksum() const;
+
+  // Write the map to a file, to be read back with Read() by the same
+  // program on the same machine. Read() returns NULL if there is no valid
+  // map at the current position of the file, or if it uses any GPIO word
+  // that "valid", a map for the same Framebuffers, does not.
+  bool Write(FILE *out) const;
+  static PixelDesignatorMap *Read(FILE *in, const PixelDesignatorMap &valid);
 
 private:
   const int width_;
   const int height_;
-  const PixelDesignator fill_bits_;  // Precalculated for fill.
+  const PixelColorBits fill_bits_;  // Precalculated for fill.
   PixelDesignator *const buffer_;
+  std::vector<PixelColorBits> color_classes_;
 };
 
 // Internal representation of the frame-buffer that as well can
@@ -71,19 +116,25 @@ public:
   // refresh rate and have good color richness. This is the default setting
   // However, in low-light situations, we want to be able to scale down
   // brightness more, having more bits at the bottom.
-  // TODO(hzeller): make the default 15 bit or so, but slide the use of
-  //  timing to lower bits if fewer bits requested to not affect the overall
-  //  refresh in that case.
-  //  This needs to be balanced to not create too agressive timing however.
-  //  To be explored in a separete commit.
   //
-  // For now, if someone needs very low level of light, change this to
-  // say 13 and recompile. Run with --led-pwm-bits=13. Also, consider
-  // --led-pwm-dither-bits=2 to have the refresh rate not suffer too much.
-  static constexpr int kBitPlanes = 11;
+  // So if someone needs very low level of light, run with say
+  // --led-pwm-bits=13. Each additional bit doubles the time of the
+  // brightest bitplane, so also consider --led-pwm-dither-bits=2 to have the
+  // refresh rate not suffer too much.
+  static constexpr int kMaxBitPlanes = 15;
   static constexpr int kDefaultBitPlanes = 11;
 
-  Framebuffer(int rows, int columns, int parallel,
+  // Color bits of one chain: r1, g1, b1, r2, g2, b2.
+  static constexpr int kChainColorBits = 6;
+#ifdef COMPACT_FRAMEBUFFER
+  static constexpr int kMaxStoredChains = 2;
+#else
+  static constexpr int kMaxStoredChains = 6;
+#endif
+
+  // The Framebuffer stores "pwm_bits" bitplanes; SetPWMBits() can only choose
+  // fewer later.
+  Framebuffer(int rows, int columns, int parallel, int pwm_bits,
               int scan_mode,
               const char* led_sequence, bool inverse_color,
               PixelDesignatorMap **mapper);
@@ -95,27 +146,42 @@ public:
                        bool allow_hardware_pulsing,
                        int pwm_lsb_nanoseconds,
                        int dither_bits,
-                       int row_address_type);
+                       int row_address_type,
+                       bool skip_reclock);
   static void InitializePanels(GPIO *io, const char *panel_type, int columns);
 
+  // Keep the color data of Framebuffers in the native layout of the GPIO
+  // backend, if it has one for the colors of "parallel" chains (see
+  // GPIOBackend::UseNativeColorLayout()). Then no bits need to be
+  // translated in DumpToMatrix(). The layout is chosen when a Framebuffer is
+  // constructed, so call after InitHardwareMapping(), before the first one.
+  static void InitNativeLayout(GPIO *io, int parallel);
+
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // simple comic-colors, 1 might be sufficient. Lower require less CPU.
-  // Returns boolean to signify if value was within range.
+  // Returns boolean to signify if value was within range, i.e. not more than
+  // the Framebuffer was created with.
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits() { return pwm_bits_; }
 
   // Map brightness of output linearly to input with CIE1931 profile.
-  void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
+  void set_luminance_correct(bool on);
   bool luminance_correct() const { return do_luminance_correct_; }
 
   // Set brightness in percent; range=1..100
   // This will only affect newly set pixels.
-  void SetBrightness(uint8_t b) {
-    brightness_ = (b <= 100 ? (b != 0 ? b : 1) : 100);
-  }
+  void SetBrightness(uint8_t b);
   uint8_t brightness() { return brightness_; }
 
-  void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
+  // Set brightness in percent of the output of all Framebuffers; range=1..100
+  // This shortens the time the LEDs are on, from the next refresh on, so no
+  // pixels need to be set again.
+  static void SetRefreshBrightness(uint8_t percent);
+  static uint8_t refresh_brightness();
+
+  // Returns the number of bitplanes of a row that were already in the shift
+  // registers and did not need to be clocked in.
+  int DumpToMatrix(GPIO *io, int pwm_bits_to_show);
 
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
@@ -126,6 +192,8 @@ public:
   int width() const;
   int height() const;
   void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue);
+  void SetPixels(int x, int y, int width, int height,
+                 const uint8_t *image, size_t stride, bool is_bgr);
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
@@ -133,6 +201,24 @@ private:
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
 
+  // Set by InitNativeLayout(); NULL if we use the bits of the hardware mapping.
+  static GPIO *native_io_;
+  static gpio_bits_t native_color_mask_;
+
+  // Color and clock bits, set while clocking in a column.
+  static gpio_bits_t color_clk_mask_;
+
+  // The refresh loop of DumpToMatrix(), instantiated for each row address
+  // setter, color layout and scan mode, so none of these need to be looked
+  // at while refreshing. InitGPIO() picks the ones for our row address
+  // setter; they are indexed by [native_layout_][interlaced].
+  typedef int (Framebuffer::*DumpRowsFunction)(GPIO *io, int start_bit,
+                                               int first_pulse);
+  static DumpRowsFunction dump_rows_[2][2];
+  template <class RowSetter> static void SelectDumpRows();
+  template <class RowSetter, bool kNativeLayout, bool kInterlaced>
+  int DumpRows(GPIO *io, int start_bit, int first_pulse);
+
   // This returns the gpio-bit for given color (one of 'R', 'G', 'B'). This is
   // returning the right value in case "led_sequence" is _not_ "RGB"
   static gpio_bits_t GetGpioFromLedSequence(char col, const char *led_sequence,
@@ -140,10 +226,31 @@ private:
                                             gpio_bits_t default_g,
                                             gpio_bits_t default_b);
 
-  void InitDefaultDesignator(int x, int y, const char *led_sequence,
-                             PixelDesignator *designator);
+  // Set up the PixelDesignators of row "y" of the physical layout.
+  void InitDefaultDesignators(int y, const char *led_sequence,
+                              PixelDesignatorMap *map);
+  // The color bits of the hardware mapping as we store them.
+  gpio_bits_t StoredColorBits(gpio_bits_t bits) const;
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
+
+  // The bitplanes SetPixel() sets for each 8 bit color value, from the lowest
+  // one shown: three bits per bitplane, of which this is the lowest. So the
+  // values of red, green and blue shifted by 0, 1 and 2 bits give a three
+  // bit pattern for each bitplane. Rebuilt whenever MapColors() changes.
+  uint64_t plane_spread_[256];
+  // The same as values: bit 0 is the lowest bitplane shown.
+  uint16_t plane_values_[256];
+  void UpdatePlaneSpread();
+
+  inline void SetDesignatedPixel(long gpio_word,
+                                 const PixelColorBits &colors,
+                                 uint8_t r, uint8_t g, uint8_t b);
+  // Set "count" pixels from "pixel" on, the first at "gpio_word", the others
+  // in the following columns.
+  template <bool kKeepSignatures>
+  void SetPixelRun(long gpio_word, const PixelColorBits &colors,
+                   int count, const uint8_t *pixel, int r_offset, int b_offset);
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
@@ -151,6 +258,17 @@ private:
 
   const int scan_mode_;
   const bool inverse_color_;
+  const bool native_layout_;  // Bits in the bitplane_buffer_ are native.
+
+  // Colors are mapped to bitplanes_ bits: the pwm_bits we were created with,
+  // but at least kDefaultBitPlanes. Fewer bits are shown by leaving out the
+  // lowest bitplanes, so the timing of the others does not change. Only the
+  // bitplanes from lowest_bitplane_ on can ever be shown; only these are
+  // stored.
+  const int bitplanes_;
+  const int lowest_bitplane_;
+  const int stored_bitplanes_;
+  const ColorLookup *const luminance_lookup_;  // For bitplanes_.
 
   uint8_t pwm_bits_;   // PWM bits to display.
   bool do_luminance_correct_;
@@ -165,8 +283,30 @@ private:
   // Each bitplane-column is pre-filled IoBits, of which the colors are set.
   // Of course, that means that we store unrelated bits in the frame-buffer,
   // but it allows easy access in the critical section.
-  gpio_bits_t *bitplane_buffer_;
-  inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
+  plane_bits_t *bitplane_buffer_;
+  inline plane_bits_t *ValueAt(int double_row, int column, int bit);
+
+  // For each double-row and bitplane, the number of columns with any color
+  // bit set. Kept up to date by everything that writes the bitplane_buffer_,
+  // so DumpToMatrix() knows which bitplanes are blank without looking.
+  int *nonblank_columns_;
+  inline int *NonblankColumnsAt(int double_row, int bit);
+
+  // Likewise, a signature of each double-row and bitplane: the sum of all
+  // columns, each multiplied with a weight for its column.
+  uint32_t *signatures_;
+  uint32_t *column_weights_;
+  uint32_t column_weight_sum_;
+  inline uint32_t *SignatureAt(int double_row, int bit);
+
+  void UpdateRowSummaries();   // Recalculate the above from scratch.
+
+  // For panels that can light several rows of a group at the same time:
+  // find double-rows showing the same bitplanes from "start_bit" on as an
+  // earlier one in their group of "group_size". Sets "row_bits" of each
+  // double-row to the rows of its group to light with it (bit 0 being the
+  // first of the group), or to 0 if it is lit with an earlier one.
+  void FindIdenticalRows(int start_bit, int group_size, uint32_t *row_bits);
 
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
 };
@@ -28,8 +28,11 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <type_traits>
 
 #include "gpio.h"
+#include "rockchip-mapping.h"
 
 namespace rgb_matrix {
 namespace internal {
@@ -37,6 +40,54 @@ namespace internal {
 // implementations depending on the context.
 static PinPulser *sOutputEnablePulser = NULL;
 
+// While clocking in a row, the pulser gets a chance to end its pulse after
+// this many columns.
+static const int kPulsePollColumns = 8;
+
+// Brightness in percent the output enable pulses are scaled to. The pulser
+// has the timings of all kMaxBitPlanes for each of them, from 100% down.
+// Set from any thread, read by the refresh thread.
+static std::atomic<int> sRefreshBrightness(100);
+
+// For each refresh brightness: the lowest bitplane shown. The pulses of the
+// ones below would be shorter than the LSB time.
+static int sRefreshLowBit[101];
+
+// What we last clocked into the shift registers of the panels. If the same
+// is needed again, there is no need to clock it in.
+static bool sShiftRegistersKnown = false;
+static bool sShiftRegistersBlank = false;
+static uint32_t sShiftRegisterSignature = 0;
+
+// Also compare non-blank bitplanes. A copy of the shift registers confirms
+// that signatures that are the same actually come from the same data.
+static bool sSkipReclock = false;
+static plane_bits_t *sShiftRegisterData = NULL;
+
+// If anything uses the signatures of the rows, so SetPixel() has to keep them
+// up to date. They only point out rows worth comparing, so if they are not
+// (e.g. for pixels set before InitGPIO()), we only miss out on skipping work.
+static bool sKeepSignatures = false;
+
+// Weight of a column in the signatures. Odd, so a change in a single column
+// always changes the signature.
+static inline uint32_t ColumnWeight(int column) {
+  uint64_t z = (column + 1) * 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return (uint32_t)(z ^ (z >> 31)) | 1;
+}
+
+// A few columns of a bitplane, for SetPixels() to go through at once. The
+// compiler uses NEON or SSE instructions for these.
+typedef plane_bits_t ColumnVector __attribute__((vector_size(16)));
+typedef std::make_signed<plane_bits_t>::type SignedColumnBits;
+typedef SignedColumnBits SignedColumnVector __attribute__((vector_size(16)));
+static const int kColumnRunLanes = sizeof(ColumnVector) / sizeof(plane_bits_t);
+// Signatures of these columns, which are 32 bit whatever the bitplanes store.
+typedef uint32_t ColumnSignatureVector
+  __attribute__((vector_size(kColumnRunLanes * sizeof(uint32_t))));
+
 #ifdef ONLY_SINGLE_SUB_PANEL
 #  define SUB_PANELS_ 1
 #else
@@ -49,12 +100,139 @@ PixelDesignator *PixelDesignatorMap::get(int x, int y) {
   return buffer_ + (y*width_) + x;
 }
 
+const PixelDesignator *PixelDesignatorMap::get(int x, int y) const {
+  if (x < 0 || y < 0 || x >= width_ || y >= height_)
+    return NULL;
+  return buffer_ + (y*width_) + x;
+}
+
 PixelDesignatorMap::PixelDesignatorMap(int width, int height,
-                                       const PixelDesignator &fill_bits)
+                                       const PixelColorBits &fill_bits)
   : width_(width), height_(height), fill_bits_(fill_bits),
     buffer_(new PixelDesignator[width * height]) {
 }
 
+PixelDesignatorMap::PixelDesignatorMap(int width, int height,
+                                       const PixelDesignatorMap &other)
+  : width_(width), height_(height), fill_bits_(other.fill_bits_),
+    buffer_(new PixelDesignator[width * height]),
+    color_classes_(other.color_classes_) {
+}
+
+PixelDesignatorMap::PixelDesignatorMap(const PixelDesignatorMap &other)
+  : width_(other.width_), height_(other.height_), fill_bits_(other.fill_bits_),
+    buffer_(new PixelDesignator[width_ * height_]),
+    color_classes_(other.color_classes_) {
+  std::copy(other.buffer_, other.buffer_ + width_ * height_, buffer_);
+}
+
+uint64_t PixelDesignatorMap::Checksum() const {
+  uint64_t result = 0xcbf29ce484222325ull;  // FNV-1a
+  const uint8_t *const begin = reinterpret_cast<const uint8_t*>(buffer_);
+  const uint8_t *const end = begin + width_ * height_ * sizeof(*buffer_);
+  for (const uint8_t *it = begin; it < end; ++it) {
+    result = (result ^ *it) * 0x100000001b3ull;
+  }
+  for (size_t i = 0; i < color_classes_.size(); ++i) {
+    const PixelColorBits &c = color_classes_[i];
+    const gpio_bits_t bits[] = { c.r_bit, c.g_bit, c.b_bit, c.mask };
+    for (size_t j = 0; j < sizeof(bits) / sizeof(bits[0]); ++j) {
+      result = (result ^ bits[j]) * 0x100000001b3ull;
+    }
+  }
+  return result;
+}
+
+// The file format of Write()/Read(), after the header: the fill bits, the
+// color classes, the PixelDesignators and their Checksum(). All in the layout
+// of this machine.
+namespace {
+struct MapFileHeader {
+  uint32_t magic;
+  uint32_t width;
+  uint32_t height;
+  uint32_t color_classes;
+};
+}
+static const uint32_t kMapFileMagic = 0x314d4450;  // "PDM1"
+
+bool PixelDesignatorMap::Write(FILE *out) const {
+  const MapFileHeader header = { kMapFileMagic, (uint32_t)width_,
+                                 (uint32_t)height_,
+                                 (uint32_t)color_classes_.size() };
+  const uint64_t checksum = Checksum();
+  return (fwrite(&header, sizeof(header), 1, out) == 1
+          && fwrite(&fill_bits_, sizeof(fill_bits_), 1, out) == 1
+          && fwrite(color_classes_.data(), sizeof(PixelColorBits),
+                    color_classes_.size(), out) == color_classes_.size()
+          && fwrite(buffer_, sizeof(*buffer_), width_ * height_, out)
+          == (size_t)(width_ * height_)
+          && fwrite(&checksum, sizeof(checksum), 1, out) == 1);
+}
+
+PixelDesignatorMap *PixelDesignatorMap::Read(
+  FILE *in, const PixelDesignatorMap &valid) {
+  MapFileHeader header;
+  PixelColorBits fill_bits;
+  if (fread(&header, sizeof(header), 1, in) != 1
+      || header.magic != kMapFileMagic
+      || header.width == 0 || header.width > 65536
+      || header.height == 0 || header.height > 65536
+      || header.color_classes > 1024
+      || fread(&fill_bits, sizeof(fill_bits), 1, in) != 1) {
+    return NULL;
+  }
+  PixelDesignatorMap *result = new PixelDesignatorMap(header.width,
+                                                      header.height,
+                                                      fill_bits);
+  result->color_classes_.resize(header.color_classes);
+  const size_t designators = header.width * header.height;
+  uint64_t checksum;
+  if (fread(result->color_classes_.data(), sizeof(PixelColorBits),
+            header.color_classes, in) != header.color_classes
+      || fread(result->buffer_, sizeof(PixelDesignator), designators, in)
+      != designators
+      || fread(&checksum, sizeof(checksum), 1, in) != 1
+      || checksum != result->Checksum()) {
+    delete result;
+    return NULL;
+  }
+  // Only words that "valid" uses are within the bitplanes of a row.
+  const size_t valid_designators = valid.width_ * valid.height_;
+  int32_t words = 0;
+  for (size_t i = 0; i < valid_designators; ++i) {
+    words = std::max(words, valid.buffer_[i].gpio_word + 1);
+  }
+  std::vector<bool> valid_word(words, false);
+  for (size_t i = 0; i < valid_designators; ++i) {
+    if (valid.buffer_[i].gpio_word >= 0)
+      valid_word[valid.buffer_[i].gpio_word] = true;
+  }
+  for (size_t i = 0; i < designators; ++i) {
+    const PixelDesignator &d = result->buffer_[i];
+    if (d.color_class >= header.color_classes
+        || (d.gpio_word != -1
+            && (d.gpio_word < 0 || d.gpio_word >= words
+                || !valid_word[d.gpio_word]))) {
+      delete result;
+      return NULL;
+    }
+  }
+  return result;
+}
+
+uint32_t PixelDesignatorMap::GetColorClass(const PixelColorBits &color_bits) {
+  for (size_t i = 0; i < color_classes_.size(); ++i) {
+    const PixelColorBits &c = color_classes_[i];
+    if (c.r_bit == color_bits.r_bit && c.g_bit == color_bits.g_bit
+        && c.b_bit == color_bits.b_bit && c.mask == color_bits.mask) {
+      return i;
+    }
+  }
+  color_classes_.push_back(color_bits);
+  return color_classes_.size() - 1;
+}
+
 PixelDesignatorMap::~PixelDesignatorMap() {
   delete [] buffer_;
 }
@@ -66,6 +244,15 @@ public:
   virtual ~RowAddressSetter() {}
   virtual gpio_bits_t need_bits() const = 0;
   virtual void SetRowAddress(GPIO *io, int row) = 0;
+
+  // Some panels can light several rows of a group at the same time. Groups
+  // are this many rows, starting at a multiple of it.
+  static const int kRowGroupSize = 1;
+
+  // Light the rows of the group of "row" that are set in "row_bits", bit 0
+  // being the first row of the group. Only if kRowGroupSize > 1; setters
+  // that can do that hide this with their implementation.
+  void SetRowGroupAddress(GPIO *io, int row, uint32_t row_bits) { assert(0); }
 };
 
 namespace {
@@ -115,7 +302,7 @@ private:
 // (rows 1-8/33-40, 9-16/41-48, 17-24/49-56, 25-32/57-64).
 // Rows are enabled by shifting in 8 bits (high bit first) with a high bit
 // enabling that row. This allows up to 8 rows per group to be active at the
-// same time (if they have the same content), but that isn't implemented here.
+// same time, which DumpToMatrix() uses for rows with the same content.
 // BK, DIN and DCK are the designations on the SM5266P datasheet.
 // BK = Enable Input, DIN = Serial In, DCK = Clock
 class SM5266RowAddressSetter : public RowAddressSetter {
@@ -123,6 +310,7 @@ public:
   SM5266RowAddressSetter(int double_rows, const HardwareMapping &h)
     : row_mask_(h.a | h.b | h.c),
       last_row_(-1),
+      last_row_bits_(0),
       bk_(h.c),
       din_(h.b),
       dck_(h.a) {
@@ -140,20 +328,27 @@ public:
   virtual gpio_bits_t need_bits() const { return row_mask_; }
 
   virtual void SetRowAddress(GPIO *io, int row) {
-    if (row == last_row_) return;
+    SetRowGroupAddress(io, row, 1 << (row % kRowGroupSize));
+  }
+
+  static const int kRowGroupSize = 8;
+
+  void SetRowGroupAddress(GPIO *io, int row, uint32_t row_bits) {
+    if (row == last_row_ && row_bits == last_row_bits_) return;
     io->SetBits(bk_);  // Enable serial input for the shifter
     for (int r = 7; r >= 0; r--) {
-      if (row % 8 == r) {
+      if (row_bits & (1 << r)) {
         io->SetBits(din_);
       } else {
         io->ClearBits(din_);
       }
       io->SetBits(dck_);
-      io->SetBits(dck_);  // Longer clock time; tested with Pi3
+      io->RepeatSetBits(dck_);  // Longer clock time; tested with Pi3
       io->ClearBits(dck_);
     }
     io->ClearBits(bk_);  // Disable serial input to keep unwanted bits out of the shifters
     last_row_ = row;
+    last_row_bits_ = row_bits;
     // Set bits D and E to enable the proper shifter to display the selected
     // row.
     io->WriteMaskedBits(row_lookup_[row], row_mask_);
@@ -162,6 +357,7 @@ public:
 private:
   gpio_bits_t row_mask_;
   int last_row_;
+  uint32_t last_row_bits_;
   const gpio_bits_t bk_;
   const gpio_bits_t din_;
   const gpio_bits_t dck_;
@@ -179,6 +375,15 @@ public:
 
   virtual void SetRowAddress(GPIO *io, int row) {
     if (row == last_row_) return;
+    if (row == last_row_ + 1 && last_row_ > 0) {
+      // The closing clock of a reload below shifts in one more high bit,
+      // which already puts the next row in place: a single clock selects
+      // it. Not so after row 0, where that extra bit is the low one.
+      io->ClearBits(clock_);
+      io->SetBits(clock_);
+      last_row_ = row;
+      return;
+    }
     for (int activate = 0; activate < double_rows_; ++activate) {
       io->ClearBits(clock_);
       if (activate == double_rows_ - 1 - row) {
@@ -216,6 +421,15 @@ public:
   virtual gpio_bits_t need_bits() const { return row_mask_; }
 
   virtual void SetRowAddress(GPIO *io, int row) {
+    if (row == last_row_) return;
+    if (row == last_row_ + 1 && last_row_ >= 0) {
+      // Moving on to the next row is shifting in one more low bit.
+      io->ClearBits(data_);
+      io->SetBits(clock_);
+      io->ClearBits(clock_);
+      last_row_ = row;
+      return;
+    }
     for (int activate = 0; activate < double_rows_; ++activate) {
       io->ClearBits(clock_);
       if (activate == double_rows_ - 1 - row) {
@@ -280,10 +494,103 @@ private:
 
 }
 
+// The color bits of the first "parallel" chains.
+static gpio_bits_t GetColorBits(const struct HardwareMapping &h, int parallel) {
+  gpio_bits_t result = 0;
+  result |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
+  if (parallel >= 2) {
+    result |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
+  }
+  if (parallel >= 3) {
+    result |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
+  }
+  if (parallel >= 4) {
+    result |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
+  }
+  if (parallel >= 5) {
+    result |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
+  }
+  if (parallel >= 6) {
+    result |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
+  }
+  return result;
+}
+
+#ifdef COMPACT_FRAMEBUFFER
+static const int kCompactColorBits
+  = Framebuffer::kChainColorBits * Framebuffer::kMaxStoredChains;
+
+// The GPIO bit of each bit of the compact layout.
+static void GetCompactColorOrder(const struct HardwareMapping &h,
+                                 gpio_bits_t order[kCompactColorBits]) {
+  const gpio_bits_t colors[] = {
+    h.p0_r1, h.p0_g1, h.p0_b1, h.p0_r2, h.p0_g2, h.p0_b2,
+    h.p1_r1, h.p1_g1, h.p1_b1, h.p1_r2, h.p1_g2, h.p1_b2,
+  };
+  static_assert(sizeof(colors) / sizeof(colors[0]) == kCompactColorBits,
+                "one GPIO bit for each compact bit");
+  for (int i = 0; i < kCompactColorBits; ++i) order[i] = colors[i];
+}
+
+// Expands each byte of the compact color bits to GPIO bits while clocking
+// out. Set up by InitGPIO().
+static gpio_bits_t sColorExpansion[sizeof(plane_bits_t)][256];
+
+static inline gpio_bits_t ExpandColorBits(plane_bits_t bits) {
+  gpio_bits_t result = 0;
+  for (size_t i = 0; i < sizeof(plane_bits_t); ++i, bits >>= 8) {
+    result |= sColorExpansion[i][bits & 0xff];
+  }
+  return result;
+}
+#else
+static inline gpio_bits_t ExpandColorBits(plane_bits_t bits) { return bits; }
+#endif
+
+// Luminance 0..1 of a lightness 0..100 with the CIE1931 profile.
+static double cie1931(double v) {
+  const double l = (v + 16) / 116.0;  // Cubed, cheaper than pow().
+  return (v <= 8) ? v / 902.3 : l * l * l;
+}
+
+// Do CIE1931 luminance correction and scale to output bitplanes
+static uint16_t luminance_cie1931(int bitplanes,
+                                  uint8_t c, uint8_t brightness) {
+  float out_factor = ((1 << bitplanes) - 1);
+  float v = (float) c * brightness / 255.0;
+  return roundf(out_factor * cie1931(v));
+}
+
+struct ColorLookup {
+  uint16_t color[256];
+};
+static ColorLookup *CreateLuminanceCIE1931LookupTable(int bitplanes) {
+  ColorLookup *for_brightness = new ColorLookup[100];
+  for (int c = 0; c < 256; ++c)
+    for (int b = 0; b < 100; ++b)
+      for_brightness[b].color[c] = luminance_cie1931(bitplanes, c, b + 1);
+
+  return for_brightness;
+}
+
+// Lookup tables for the bitplane counts in use. Created along with the
+// Framebuffers, which then use them from any thread.
+static const ColorLookup *GetLuminanceLookup(int bitplanes) {
+  static ColorLookup *luminance_lookup[Framebuffer::kMaxBitPlanes + 1];
+  if (luminance_lookup[bitplanes] == NULL) {
+    luminance_lookup[bitplanes] = CreateLuminanceCIE1931LookupTable(bitplanes);
+  }
+  return luminance_lookup[bitplanes];
+}
+
 const struct HardwareMapping *Framebuffer::hardware_mapping_ = NULL;
 RowAddressSetter *Framebuffer::row_setter_ = NULL;
+GPIO *Framebuffer::native_io_ = NULL;
+gpio_bits_t Framebuffer::native_color_mask_ = 0;
+gpio_bits_t Framebuffer::color_clk_mask_ = 0;
+Framebuffer::DumpRowsFunction Framebuffer::dump_rows_[2][2];
 
-Framebuffer::Framebuffer(int rows, int columns, int parallel,
+Framebuffer::Framebuffer(int rows, int columns, int parallel, int pwm_bits,
                          int scan_mode,
                          const char *led_sequence, bool inverse_color,
                          PixelDesignatorMap **mapper)
@@ -293,9 +600,15 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     columns_(columns),
     scan_mode_(scan_mode),
     inverse_color_(inverse_color),
-    pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    native_layout_(native_io_ != NULL),
+    bitplanes_(std::max(pwm_bits, (int)kDefaultBitPlanes)),
+    lowest_bitplane_(bitplanes_ - pwm_bits),
+    stored_bitplanes_(pwm_bits),
+    luminance_lookup_(GetLuminanceLookup(bitplanes_)),
+    pwm_bits_(pwm_bits), do_luminance_correct_(true), brightness_(100),
     double_rows_(rows / SUB_PANELS_),
-    buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
+    buffer_size_(double_rows_ * columns_ * stored_bitplanes_
+                 * sizeof(plane_bits_t)),
     shared_mapper_(mapper) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
@@ -308,8 +621,24 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     abort();
   }
   assert(parallel >= 1 && parallel <= 6);
-
-  bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+  if (parallel > kMaxStoredChains) {
+    fprintf(stderr, "The compact framebuffer only supports %d parallel "
+            "chains, but %d was requested.\n", kMaxStoredChains, parallel);
+    abort();
+  }
+  assert(pwm_bits >= 1 && pwm_bits <= kMaxBitPlanes);
+  UpdatePlaneSpread();
+
+  bitplane_buffer_ = new plane_bits_t[double_rows_ * columns_
+                                      * stored_bitplanes_];
+  nonblank_columns_ = new int[double_rows_ * stored_bitplanes_];
+  signatures_ = new uint32_t[double_rows_ * stored_bitplanes_];
+  column_weights_ = new uint32_t[columns_];
+  column_weight_sum_ = 0;
+  for (int col = 0; col < columns_; ++col) {
+    column_weights_[col] = ColumnWeight(col);
+    column_weight_sum_ += column_weights_[col];
+  }
 
   // If we're the first Framebuffer created, the shared PixelMapper is
   // still NULL, so create one.
@@ -326,16 +655,17 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     gpio_bits_t r = h.p0_r1 | h.p0_r2 | h.p1_r1 | h.p1_r2 | h.p2_r1 | h.p2_r2 | h.p3_r1 | h.p3_r2 | h.p4_r1 | h.p4_r2 | h.p5_r1 | h.p5_r2;
     gpio_bits_t g = h.p0_g1 | h.p0_g2 | h.p1_g1 | h.p1_g2 | h.p2_g1 | h.p2_g2 | h.p3_g1 | h.p3_g2 | h.p4_g1 | h.p4_g2 | h.p5_g1 | h.p5_g2;
     gpio_bits_t b = h.p0_b1 | h.p0_b2 | h.p1_b1 | h.p1_b2 | h.p2_b1 | h.p2_b2 | h.p3_b1 | h.p3_b2 | h.p4_b1 | h.p4_b2 | h.p5_b1 | h.p5_b2;
-    PixelDesignator fill_bits;
+    PixelColorBits fill_bits;
     fill_bits.r_bit = GetGpioFromLedSequence('R', led_sequence, r, g, b);
     fill_bits.g_bit = GetGpioFromLedSequence('G', led_sequence, r, g, b);
     fill_bits.b_bit = GetGpioFromLedSequence('B', led_sequence, r, g, b);
+    fill_bits.r_bit = StoredColorBits(fill_bits.r_bit);
+    fill_bits.g_bit = StoredColorBits(fill_bits.g_bit);
+    fill_bits.b_bit = StoredColorBits(fill_bits.b_bit);
 
     *shared_mapper_ = new PixelDesignatorMap(columns_, height_, fill_bits);
     for (int y = 0; y < height_; ++y) {
-      for (int x = 0; x < columns_; ++x) {
-        InitDefaultDesignator(x, y, led_sequence, (*shared_mapper_)->get(x, y));
-      }
+      InitDefaultDesignators(y, led_sequence, *shared_mapper_);
     }
   }
 
@@ -344,6 +674,9 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
 
 Framebuffer::~Framebuffer() {
   delete [] bitplane_buffer_;
+  delete [] nonblank_columns_;
+  delete [] signatures_;
+  delete [] column_weights_;
 }
 
 // TODO: this should also be parsed from some special formatted string, e.g.
@@ -361,6 +694,12 @@ Framebuffer::~Framebuffer() {
     }
   }
 
+  // Not a name, but a description of where the signals are on a Rockchip.
+  if (!mapping && IsRockchipPinMappingSpec(named_hardware)) {
+    mapping = LoadRockchipPinMappingSpec(named_hardware);
+    if (!mapping) abort();  // Problem already reported.
+  }
+
   if (!mapping) {
     fprintf(stderr, "There is no hardware mapping named '%s'.\nAvailable: ",
             named_hardware);
@@ -375,69 +714,99 @@ Framebuffer::~Framebuffer() {
   if (mapping->max_parallel_chains == 0) {
     // Auto determine.
     struct HardwareMapping *h = mapping;
-    if ((h->p0_r1 | h->p0_g1 | h->p0_g1 | h->p0_r2 | h->p0_g2 | h->p0_g2) > 0)
+    if ((h->p0_r1 | h->p0_g1 | h->p0_b1 | h->p0_r2 | h->p0_g2 | h->p0_b2) > 0)
       ++mapping->max_parallel_chains;
-    if ((h->p1_r1 | h->p1_g1 | h->p1_g1 | h->p1_r2 | h->p1_g2 | h->p1_g2) > 0)
+    if ((h->p1_r1 | h->p1_g1 | h->p1_b1 | h->p1_r2 | h->p1_g2 | h->p1_b2) > 0)
       ++mapping->max_parallel_chains;
-    if ((h->p2_r1 | h->p2_g1 | h->p2_g1 | h->p2_r2 | h->p2_g2 | h->p2_g2) > 0)
+    if ((h->p2_r1 | h->p2_g1 | h->p2_b1 | h->p2_r2 | h->p2_g2 | h->p2_b2) > 0)
       ++mapping->max_parallel_chains;
-    if ((h->p3_r1 | h->p3_g1 | h->p3_g1 | h->p3_r2 | h->p3_g2 | h->p3_g2) > 0)
+    if ((h->p3_r1 | h->p3_g1 | h->p3_b1 | h->p3_r2 | h->p3_g2 | h->p3_b2) > 0)
       ++mapping->max_parallel_chains;
-    if ((h->p4_r1 | h->p4_g1 | h->p4_g1 | h->p4_r2 | h->p4_g2 | h->p4_g2) > 0)
+    if ((h->p4_r1 | h->p4_g1 | h->p4_b1 | h->p4_r2 | h->p4_g2 | h->p4_b2) > 0)
       ++mapping->max_parallel_chains;
-    if ((h->p5_r1 | h->p5_g1 | h->p5_g1 | h->p5_r2 | h->p5_g2 | h->p5_g2) > 0)
+    if ((h->p5_r1 | h->p5_g1 | h->p5_b1 | h->p5_r2 | h->p5_g2 | h->p5_b2) > 0)
       ++mapping->max_parallel_chains;
   }
   hardware_mapping_ = mapping;
 }
 
+/* static */ void Framebuffer::InitNativeLayout(GPIO *io, int parallel) {
+  assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
+  if (!io->SetHardwareMapping(*hardware_mapping_)) {
+    abort();  // Problem already reported.
+  }
+  const gpio_bits_t colors = GetColorBits(*hardware_mapping_, parallel);
+  if (io->UseNativeColorLayout(colors)) {
+    native_io_ = io;
+    native_color_mask_ = io->NativeBits(colors);
+  } else {
+    native_io_ = NULL;
+  }
+}
+
 /* static */ void Framebuffer::InitGPIO(GPIO *io, int rows, int parallel,
                                         bool allow_hardware_pulsing,
                                         int pwm_lsb_nanoseconds,
                                         int dither_bits,
-                                        int row_address_type) {
+                                        int row_address_type,
+                                        bool skip_reclock) {
   if (sOutputEnablePulser != NULL)
     return;  // already initialized.
 
+  sSkipReclock = skip_reclock;
+
   const struct HardwareMapping &h = *hardware_mapping_;
+  if (!io->SetHardwareMapping(h)) {
+    abort();  // Problem already reported.
+  }
+
   // Tell GPIO about all bits we intend to use.
   gpio_bits_t all_used_bits = 0;
 
   all_used_bits |= h.output_enable | h.clock | h.strobe;
 
-  all_used_bits |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
-  if (parallel >= 2) {
-    all_used_bits |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
-  }
-  if (parallel >= 3) {
-    all_used_bits |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
-  }
-  if (parallel >= 4) {
-    all_used_bits |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
-  }
-  if (parallel >= 5) {
-    all_used_bits |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
-  }
-  if (parallel >= 6) {
-    all_used_bits |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
+  all_used_bits |= GetColorBits(h, parallel);
+
+  color_clk_mask_ = GetColorBits(h, parallel) | h.clock;
+
+#ifdef COMPACT_FRAMEBUFFER
+  gpio_bits_t compact_order[kCompactColorBits];
+  GetCompactColorOrder(h, compact_order);
+  for (size_t i = 0; i < sizeof(plane_bits_t); ++i) {
+    for (int value = 0; value < 256; ++value) {
+      gpio_bits_t bits = 0;
+      for (int bit = 0; bit < 8; ++bit) {
+        const int compact_bit = 8 * i + bit;
+        if ((value & (1 << bit)) && compact_bit < kCompactColorBits)
+          bits |= compact_order[compact_bit];
+      }
+      sColorExpansion[i][value] = native_io_ ? native_io_->NativeBits(bits)
+                                             : bits;
+    }
   }
+#endif
 
   const int double_rows = rows / SUB_PANELS_;
   switch (row_address_type) {
   case 0:
     row_setter_ = new DirectRowAddressSetter(double_rows, h);
+    SelectDumpRows<DirectRowAddressSetter>();
     break;
   case 1:
     row_setter_ = new ShiftRegisterRowAddressSetter(double_rows, h);
+    SelectDumpRows<ShiftRegisterRowAddressSetter>();
     break;
   case 2:
     row_setter_ = new DirectABCDLineRowAddressSetter(double_rows, h);
+    SelectDumpRows<DirectABCDLineRowAddressSetter>();
     break;
   case 3:
     row_setter_ = new ABCShiftRegisterRowAddressSetter(double_rows, h);
+    SelectDumpRows<ABCShiftRegisterRowAddressSetter>();
     break;
   case 4:
     row_setter_ = new SM5266RowAddressSetter(double_rows, h);
+    SelectDumpRows<SM5266RowAddressSetter>();
     break;
   default:
     assert(0);  // unexpected type.
@@ -451,14 +820,51 @@ Framebuffer::~Framebuffer() {
   // Initialize outputs, make sure that all of these are supported bits.
   const gpio_bits_t result = io->InitOutputs(all_used_bits,
                                              is_some_adafruit_hat);
-  assert(result == all_used_bits);  // Impl: all bits declared in gpio.cc ?
+  if (result != all_used_bits) {
+    // Typically a parallel chain the HardwareMapping knows about, but that
+    // is not wired up on this board (e.g. no Rockchip pins for it).
+    fprintf(stderr, "The %s GPIO mapping can not output all signals needed "
+            "for %d parallel chain%s on the %s GPIO (missing bits 0x%llx).\n",
+            h.name, parallel, parallel > 1 ? "s" : "", io->backend()->name(),
+            (unsigned long long)(all_used_bits & ~result));
+    abort();
+  }
 
-  std::vector<int> bitplane_timings;
+  uint32_t full_timings[kMaxBitPlanes];
   uint32_t timing_ns = pwm_lsb_nanoseconds;
-  for (int b = 0; b < kBitPlanes; ++b) {
-    bitplane_timings.push_back(timing_ns);
+  for (int b = 0; b < kMaxBitPlanes; ++b) {
+    full_timings[b] = timing_ns;
     if (b >= dither_bits) timing_ns *= 2;
   }
+
+  // The timings of all bitplanes for each refresh brightness, 100% first.
+  // They are scaled like the colors with SetBrightness(). Pulses shorter than
+  // the LSB time can't be timed well (the Pi PWM can't do them at all), so
+  // the bitplanes that would need them are left out, like the dithered ones.
+  // The others keep the exact ratios of their times, so brighter values stay
+  // brighter. A Framebuffer always shows its top bitplane though, so if that
+  // is below the lowest one, it gets at least the LSB time.
+  std::vector<int> bitplane_timings;
+  for (int percent = 100; percent >= 1; --percent) {
+    const double scale = cie1931(percent);
+    int low_bit = 0;
+    while (low_bit < kMaxBitPlanes - 1
+           && full_timings[low_bit] * scale < pwm_lsb_nanoseconds) {
+      ++low_bit;
+    }
+    sRefreshLowBit[percent] = low_bit;
+    const int low_ns = std::max(pwm_lsb_nanoseconds,
+                                (int)lround(full_timings[low_bit] * scale));
+    for (int b = 0; b < kMaxBitPlanes; ++b) {
+      if (b < low_bit) {
+        bitplane_timings.push_back(
+          std::max(pwm_lsb_nanoseconds, (int)lround(full_timings[b] * scale)));
+      } else {
+        bitplane_timings.push_back(
+          low_ns * (full_timings[b] / full_timings[low_bit]));
+      }
+    }
+  }
   sOutputEnablePulser = PinPulser::Create(io, h.output_enable,
                                           allow_hardware_pulsing,
                                           bitplane_timings);
@@ -553,6 +959,7 @@ static void InitFM6127(GPIO *io, const struct HardwareMapping &h, int columns) {
                                               const char *panel_type,
                                               int columns) {
   if (!panel_type || panel_type[0] == '\0') return;
+  sShiftRegistersKnown = false;
   if (strncasecmp(panel_type, "fm6126", 6) == 0) {
     InitFM6126(io, *hardware_mapping_, columns);
   }
@@ -566,59 +973,85 @@ static void InitFM6127(GPIO *io, const struct HardwareMapping &h, int columns) {
 }
 
 bool Framebuffer::SetPWMBits(uint8_t value) {
-  if (value < 1 || value > kBitPlanes)
+  if (value < 1 || value > stored_bitplanes_)
     return false;
   pwm_bits_ = value;
+  UpdatePlaneSpread();
   return true;
 }
 
-inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
-  return &bitplane_buffer_[ double_row * (columns_ * kBitPlanes)
-                            + bit * columns_
-                            + column ];
+void Framebuffer::set_luminance_correct(bool on) {
+  do_luminance_correct_ = on;
+  UpdatePlaneSpread();
 }
 
-void Framebuffer::Clear() {
-  if (inverse_color_) {
-    Fill(0, 0, 0);
-  } else  {
-    // Cheaper.
-    memset(bitplane_buffer_, 0,
-           sizeof(*bitplane_buffer_) * double_rows_ * columns_ * kBitPlanes);
-  }
+/* static */ void Framebuffer::SetRefreshBrightness(uint8_t percent) {
+  sRefreshBrightness = (percent <= 100 ? (percent != 0 ? percent : 1) : 100);
 }
 
-// Do CIE1931 luminance correction and scale to output bitplanes
-static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness) {
-  float out_factor = ((1 << internal::Framebuffer::kBitPlanes) - 1);
-  float v = (float) c * brightness / 255.0;
-  return roundf(out_factor * ((v <= 8) ? v / 902.3 : pow((v + 16) / 116.0, 3)));
+/* static */ uint8_t Framebuffer::refresh_brightness() {
+  return sRefreshBrightness;
 }
 
-struct ColorLookup {
-  uint16_t color[256];
-};
-static ColorLookup *CreateLuminanceCIE1931LookupTable() {
-  ColorLookup *for_brightness = new ColorLookup[100];
-  for (int c = 0; c < 256; ++c)
-    for (int b = 0; b < 100; ++b)
-      for_brightness[b].color[c] = luminance_cie1931(c, b + 1);
+void Framebuffer::SetBrightness(uint8_t b) {
+  brightness_ = (b <= 100 ? (b != 0 ? b : 1) : 100);
+  UpdatePlaneSpread();
+}
 
-  return for_brightness;
+inline plane_bits_t *Framebuffer::ValueAt(int double_row, int column,
+                                           int bit) {
+  return &bitplane_buffer_[ double_row * (columns_ * stored_bitplanes_)
+                            + (bit - lowest_bitplane_) * columns_
+                            + column ];
+}
+
+inline int *Framebuffer::NonblankColumnsAt(int double_row, int bit) {
+  return &nonblank_columns_[double_row * stored_bitplanes_
+                            + bit - lowest_bitplane_];
+}
+
+inline uint32_t *Framebuffer::SignatureAt(int double_row, int bit) {
+  return &signatures_[double_row * stored_bitplanes_
+                      + bit - lowest_bitplane_];
+}
+
+void Framebuffer::UpdateRowSummaries() {
+  for (int row = 0; row < double_rows_; ++row) {
+    for (int b = lowest_bitplane_; b < bitplanes_; ++b) {
+      const plane_bits_t *row_data = ValueAt(row, 0, b);
+      int count = 0;
+      uint32_t signature = 0;
+      for (int col = 0; col < columns_; ++col) {
+        if (row_data[col]) ++count;
+        signature += (uint32_t)row_data[col] * column_weights_[col];
+      }
+      *NonblankColumnsAt(row, b) = count;
+      *SignatureAt(row, b) = signature;
+    }
+  }
 }
 
-static inline uint16_t CIEMapColor(uint8_t brightness, uint8_t c) {
-  static ColorLookup *luminance_lookup = CreateLuminanceCIE1931LookupTable();
-  return luminance_lookup[brightness - 1].color[c];
+void Framebuffer::Clear() {
+  if (inverse_color_) {
+    Fill(0, 0, 0);
+  } else  {
+    // Cheaper.
+    memset(bitplane_buffer_, 0, buffer_size_);
+    memset(nonblank_columns_, 0,
+           sizeof(*nonblank_columns_) * double_rows_ * stored_bitplanes_);
+    memset(signatures_, 0,
+           sizeof(*signatures_) * double_rows_ * stored_bitplanes_);
+  }
 }
 
 // Non luminance correction. TODO: consider getting rid of this.
-static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
+static inline uint16_t DirectMapColor(int bitplanes,
+                                      uint8_t brightness, uint8_t c) {
   // simple scale down the color value
   c = c * brightness / 100;
 
   // shift to be left aligned with top-most bits.
-  constexpr int shift = internal::Framebuffer::kBitPlanes - 8;
+  const int shift = bitplanes - 8;
   return (shift > 0) ? (c << shift) : (c >> -shift);
 }
 
@@ -627,13 +1060,14 @@ inline void Framebuffer::MapColors(
   uint16_t *red, uint16_t *green, uint16_t *blue) {
 
   if (do_luminance_correct_) {
-    *red   = CIEMapColor(brightness_, r);
-    *green = CIEMapColor(brightness_, g);
-    *blue  = CIEMapColor(brightness_, b);
+    const ColorLookup &lookup = luminance_lookup_[brightness_ - 1];
+    *red   = lookup.color[r];
+    *green = lookup.color[g];
+    *blue  = lookup.color[b];
   } else {
-    *red   = DirectMapColor(brightness_, r);
-    *green = DirectMapColor(brightness_, g);
-    *blue  = DirectMapColor(brightness_, b);
+    *red   = DirectMapColor(bitplanes_, brightness_, r);
+    *green = DirectMapColor(bitplanes_, brightness_, g);
+    *blue  = DirectMapColor(bitplanes_, brightness_, b);
   }
 
   if (inverse_color_) {
@@ -643,23 +1077,39 @@ inline void Framebuffer::MapColors(
   }
 }
 
+void Framebuffer::UpdatePlaneSpread() {
+  const int min_bit_plane = bitplanes_ - pwm_bits_;
+  for (int c = 0; c < 256; ++c) {
+    uint16_t value, unused_green, unused_blue;
+    MapColors(c, c, c, &value, &unused_green, &unused_blue);
+    uint64_t spread = 0;
+    for (int b = min_bit_plane; b < bitplanes_; ++b) {
+      if (value & (1 << b)) spread |= 1ull << (3 * (b - min_bit_plane));
+    }
+    plane_spread_[c] = spread;
+    plane_values_[c] = (value >> min_bit_plane) & ((1 << pwm_bits_) - 1);
+  }
+}
+
 void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
   uint16_t red, green, blue;
   MapColors(r, g, b, &red, &green, &blue);
-  const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
+  const PixelColorBits &fill = (*shared_mapper_)->GetFillColorBits();
 
-  for (int b = kBitPlanes - pwm_bits_; b < kBitPlanes; ++b) {
+  for (int b = bitplanes_ - pwm_bits_; b < bitplanes_; ++b) {
     uint16_t mask = 1 << b;
-    gpio_bits_t plane_bits = 0;
+    plane_bits_t plane_bits = 0;
     plane_bits |= ((red & mask) == mask)   ? fill.r_bit : 0;
     plane_bits |= ((green & mask) == mask) ? fill.g_bit : 0;
     plane_bits |= ((blue & mask) == mask)  ? fill.b_bit : 0;
 
     for (int row = 0; row < double_rows_; ++row) {
-      gpio_bits_t *row_data = ValueAt(row, 0, b);
+      plane_bits_t *row_data = ValueAt(row, 0, b);
       for (int col = 0; col < columns_; ++col) {
         *row_data++ = plane_bits;
       }
+      *NonblankColumnsAt(row, b) = plane_bits ? columns_ : 0;
+      *SignatureAt(row, b) = (uint32_t)plane_bits * column_weight_sum_;
     }
   }
 }
@@ -668,28 +1118,193 @@ int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
 void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
-  const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
+  PixelDesignatorMap *const map = *shared_mapper_;
+  const PixelDesignator *designator = map->get(x, y);
   if (designator == NULL) return;
-  const long pos = designator->gpio_word;
-  if (pos < 0) return;  // non-used pixel marker.
-
-  uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
+  if (designator->gpio_word < 0) return;  // non-used pixel marker.
+  SetDesignatedPixel(designator->gpio_word, map->GetColorBits(*designator),
+                     r, g, b);
+}
 
-  gpio_bits_t *bits = bitplane_buffer_ + pos;
-  const int min_bit_plane = kBitPlanes - pwm_bits_;
-  bits += (columns_ * min_bit_plane);
-  const gpio_bits_t r_bits = designator->r_bit;
-  const gpio_bits_t g_bits = designator->g_bit;
-  const gpio_bits_t b_bits = designator->b_bit;
-  const gpio_bits_t designator_mask = designator->mask;
-  for (uint16_t mask = 1<<min_bit_plane; mask != 1<<kBitPlanes; mask <<=1 ) {
-    gpio_bits_t color_bits = 0;
-    if (red & mask)   color_bits |= r_bits;
-    if (green & mask) color_bits |= g_bits;
-    if (blue & mask)  color_bits |= b_bits;
-    *bits = (*bits & designator_mask) | color_bits;
+inline void Framebuffer::SetDesignatedPixel(long pos,
+                                            const PixelColorBits &colors,
+                                            uint8_t r, uint8_t g, uint8_t b) {
+  uint64_t planes = (plane_spread_[r]
+                     | plane_spread_[g] << 1
+                     | plane_spread_[b] << 2);
+
+  plane_bits_t *bits = bitplane_buffer_ + pos;
+  const int min_bit_plane = bitplanes_ - pwm_bits_;
+  bits += (columns_ * (min_bit_plane - lowest_bitplane_));
+  // The designator points into the lowest bitplane of its double-row.
+  const long row_start = pos / columns_;
+  int *nonblank = nonblank_columns_ + row_start + min_bit_plane
+    - lowest_bitplane_;
+  uint32_t *signature = signatures_ + row_start + min_bit_plane
+    - lowest_bitplane_;
+  const uint32_t weight = column_weights_[pos - row_start * columns_];
+  const plane_bits_t r_bits = colors.r_bit;
+  const plane_bits_t g_bits = colors.g_bit;
+  const plane_bits_t b_bits = colors.b_bit;
+  const plane_bits_t designator_mask = colors.mask;
+  // The color bits for each three bit pattern of plane_spread_.
+  const plane_bits_t pattern_bits[8] = {
+    0, r_bits, g_bits, (plane_bits_t)(r_bits | g_bits),
+    b_bits, (plane_bits_t)(r_bits | b_bits), (plane_bits_t)(g_bits | b_bits),
+    (plane_bits_t)(r_bits | g_bits | b_bits)
+  };
+  for (int plane = min_bit_plane; plane < bitplanes_; ++plane, planes >>= 3) {
+    const plane_bits_t color_bits = pattern_bits[planes & 7];
+    const plane_bits_t before = *bits;
+    *bits = (before & designator_mask) | color_bits;
+    *nonblank += (*bits != 0) - (before != 0);
+    if (sKeepSignatures) *signature += (uint32_t)(*bits - before) * weight;
     bits += columns_;
+    ++nonblank;
+    ++signature;
+  }
+}
+
+// If the designator "next" is for the column after "designator" in the same
+// bitplane, with the same color bits.
+static inline bool IsNextColumn(const PixelDesignator &designator,
+                                const PixelDesignator &next) {
+  return (designator.gpio_word >= 0
+          && next.gpio_word == designator.gpio_word + 1
+          && next.color_class == designator.color_class);
+}
+
+void Framebuffer::SetPixels(int x, int y, int width, int height,
+                            const uint8_t *image, size_t stride, bool is_bgr) {
+  if (x < 0) {
+    image += -x * 3;
+    width += x;
+    x = 0;
+  }
+  if (y < 0) {
+    image += -y * stride;
+    height += y;
+    y = 0;
+  }
+  width = std::min(width, this->width() - x);
+  height = std::min(height, this->height() - y);
+  if (width <= 0 || height <= 0) return;
+
+  const int r_offset = is_bgr ? 2 : 0;
+  const int b_offset = is_bgr ? 0 : 2;
+  PixelDesignatorMap *const map = *shared_mapper_;
+  for (int row = 0; row < height; ++row, image += stride) {
+    const PixelDesignator *designator = map->get(x, y + row);
+    const uint8_t *pixel = image;
+    // Without pixel mappers that shuffle things around, the pixels of a row
+    // are in runs of consecutive columns.
+    int run = 1;
+    for (int col = 0; col < width; col += run, designator += run,
+           pixel += 3 * run) {
+      run = 1;
+      while (col + run < width
+             && IsNextColumn(designator[run - 1], designator[run])) {
+        ++run;
+      }
+      if (run >= kColumnRunLanes) {
+        const PixelColorBits &colors = map->GetColorBits(*designator);
+        if (sKeepSignatures) {
+          SetPixelRun<true>(designator->gpio_word, colors, run, pixel,
+                            r_offset, b_offset);
+        } else {
+          SetPixelRun<false>(designator->gpio_word, colors, run, pixel,
+                             r_offset, b_offset);
+        }
+      } else {
+        for (int i = 0; i < run; ++i) {
+          if (designator[i].gpio_word < 0) continue;
+          const uint8_t *p = pixel + 3 * i;
+          SetDesignatedPixel(designator[i].gpio_word,
+                             map->GetColorBits(designator[i]),
+                             p[r_offset], p[1], p[b_offset]);
+        }
+      }
+    }
+  }
+}
+
+template <bool kKeepSignatures>
+void Framebuffer::SetPixelRun(long gpio_word, const PixelColorBits &colors,
+                              int count, const uint8_t *pixel,
+                              int r_offset, int b_offset) {
+  typedef SignedColumnVector ColumnMask;
+  const int kLanes = kColumnRunLanes;
+  const int min_bit_plane = bitplanes_ - pwm_bits_;
+  const long row_offset = gpio_word / columns_;
+  const int double_row = row_offset / stored_bitplanes_;
+  const int first_column = gpio_word - row_offset * columns_;
+  const ColumnVector r_bits = ColumnVector() + (plane_bits_t)colors.r_bit;
+  const ColumnVector g_bits = ColumnVector() + (plane_bits_t)colors.g_bit;
+  const ColumnVector b_bits = ColumnVector() + (plane_bits_t)colors.b_bit;
+  const ColumnVector designator_mask
+    = ColumnVector() + (plane_bits_t)colors.mask;
+  const ColumnVector zero = ColumnVector();
+
+  // Chunks of columns, of which we look up the colors first, then go
+  // through the bitplanes.
+  static const int kChunkVectors = 16;
+  ColumnVector red[kChunkVectors], green[kChunkVectors], blue[kChunkVectors];
+  ColumnSignatureVector weights[kChunkVectors];
+
+  const int vectors = count / kLanes;
+  for (int chunk = 0; chunk < vectors; chunk += kChunkVectors) {
+    const int chunk_vectors = std::min(kChunkVectors, vectors - chunk);
+    const int chunk_column = first_column + chunk * kLanes;
+    for (int v = 0; v < chunk_vectors; ++v) {
+      for (int lane = 0; lane < kLanes; ++lane, pixel += 3) {
+        red[v][lane] = plane_values_[pixel[r_offset]];
+        green[v][lane] = plane_values_[pixel[1]];
+        blue[v][lane] = plane_values_[pixel[b_offset]];
+        if (kKeepSignatures) {
+          weights[v][lane] = column_weights_[chunk_column + v * kLanes + lane];
+        }
+      }
+    }
+
+    for (int plane = min_bit_plane; plane < bitplanes_; ++plane) {
+      const ColumnVector plane_bit
+        = zero + (plane_bits_t)(1 << (plane - min_bit_plane));
+      plane_bits_t *bits = ValueAt(double_row, chunk_column, plane);
+      ColumnMask nonblank_change = ColumnMask();
+      ColumnSignatureVector signature_change = ColumnSignatureVector();
+      for (int v = 0; v < chunk_vectors; ++v, bits += kLanes) {
+        const ColumnVector color_bits
+          = ((ColumnVector)((red[v] & plane_bit) != zero) & r_bits)
+          | ((ColumnVector)((green[v] & plane_bit) != zero) & g_bits)
+          | ((ColumnVector)((blue[v] & plane_bit) != zero) & b_bits);
+        ColumnVector before;
+        memcpy(&before, bits, sizeof(before));
+        const ColumnVector after = (before & designator_mask) | color_bits;
+        memcpy(bits, &after, sizeof(after));
+        // Comparisons are -1 where true.
+        nonblank_change += (after == zero) - (before == zero);
+        if (kKeepSignatures) {
+          signature_change
+            += (__builtin_convertvector(after, ColumnSignatureVector)
+                - __builtin_convertvector(before, ColumnSignatureVector))
+            * weights[v];
+        }
+      }
+      int nonblank = 0;
+      uint32_t signature = 0;
+      for (int lane = 0; lane < kLanes; ++lane) {
+        nonblank += nonblank_change[lane];
+        signature += signature_change[lane];
+      }
+      *NonblankColumnsAt(double_row, plane) += nonblank;
+      if (kKeepSignatures) *SignatureAt(double_row, plane) += signature;
+    }
+  }
+
+  // The rest that does not fill a vector.
+  for (int i = vectors * kLanes; i < count; ++i, pixel += 3) {
+    SetDesignatedPixel(gpio_word + i, colors,
+                       pixel[r_offset], pixel[1], pixel[b_offset]);
   }
 }
 
@@ -714,81 +1329,108 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
   return default_r;  // String too long, should've been caught earlier.
 }
 
-void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
-                                        PixelDesignator *d) {
+void Framebuffer::InitDefaultDesignators(int y, const char *seq,
+                                         PixelDesignatorMap *map) {
   const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t *bits = ValueAt(y % double_rows_, x, 0);
-  d->gpio_word = bits - bitplane_buffer_;
-  d->r_bit = d->g_bit = d->b_bit = 0;
+  PixelColorBits c;
+  c.r_bit = c.g_bit = c.b_bit = 0;
   if (y < rows_) {
     if (y < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r1, h.p0_g1, h.p0_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r1, h.p0_g1, h.p0_b1);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p0_r1, h.p0_g1, h.p0_b1);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p0_r1, h.p0_g1, h.p0_b1);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p0_r1, h.p0_g1, h.p0_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p0_r2, h.p0_g2, h.p0_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p0_r2, h.p0_g2, h.p0_b2);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p0_r2, h.p0_g2, h.p0_b2);
     }
   }
   else if (y >= rows_ && y < 2 * rows_) {
     if (y - rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r1, h.p1_g1, h.p1_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r1, h.p1_g1, h.p1_b1);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p1_r1, h.p1_g1, h.p1_b1);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p1_r1, h.p1_g1, h.p1_b1);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p1_r1, h.p1_g1, h.p1_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p1_r2, h.p1_g2, h.p1_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p1_r2, h.p1_g2, h.p1_b2);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p1_r2, h.p1_g2, h.p1_b2);
     }
   }
   else if (y >= 2*rows_ && y < 3 * rows_) {
     if (y - 2*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r1, h.p2_g1, h.p2_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r1, h.p2_g1, h.p2_b1);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p2_r1, h.p2_g1, h.p2_b1);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p2_r1, h.p2_g1, h.p2_b1);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p2_r1, h.p2_g1, h.p2_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p2_r2, h.p2_g2, h.p2_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p2_r2, h.p2_g2, h.p2_b2);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p2_r2, h.p2_g2, h.p2_b2);
     }
   }
   else if (y >= 3*rows_ && y < 4 * rows_) {
     if (y - 3*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p3_r1, h.p3_g1, h.p3_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p3_r1, h.p3_g1, h.p3_b1);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p3_r1, h.p3_g1, h.p3_b1);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p3_r1, h.p3_g1, h.p3_b1);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p3_r1, h.p3_g1, h.p3_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p3_r2, h.p3_g2, h.p3_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p3_r2, h.p3_g2, h.p3_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p3_r2, h.p3_g2, h.p3_b2);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p3_r2, h.p3_g2, h.p3_b2);
     }
   }
   else if (y >= 4*rows_ && y < 5 * rows_){
     if (y - 4*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p4_r1, h.p4_g1, h.p4_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p4_r1, h.p4_g1, h.p4_b1);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p4_r1, h.p4_g1, h.p4_b1);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p4_r1, h.p4_g1, h.p4_b1);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p4_r1, h.p4_g1, h.p4_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p4_r2, h.p4_g2, h.p4_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p4_r2, h.p4_g2, h.p4_b2);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p4_r2, h.p4_g2, h.p4_b2);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p4_r2, h.p4_g2, h.p4_b2);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p4_r2, h.p4_g2, h.p4_b2);
     }
 
   }
   else {
     if (y - 5*rows_ < double_rows_) {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p5_r1, h.p5_g1, h.p5_b1);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p5_r1, h.p5_g1, h.p5_b1);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p5_r1, h.p5_g1, h.p5_b1);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p5_r1, h.p5_g1, h.p5_b1);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p5_r1, h.p5_g1, h.p5_b1);
     } else {
-      d->r_bit = GetGpioFromLedSequence('R', seq, h.p5_r2, h.p5_g2, h.p5_b2);
-      d->g_bit = GetGpioFromLedSequence('G', seq, h.p5_r2, h.p5_g2, h.p5_b2);
-      d->b_bit = GetGpioFromLedSequence('B', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+      c.r_bit = GetGpioFromLedSequence('R', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+      c.g_bit = GetGpioFromLedSequence('G', seq, h.p5_r2, h.p5_g2, h.p5_b2);
+      c.b_bit = GetGpioFromLedSequence('B', seq, h.p5_r2, h.p5_g2, h.p5_b2);
     }
   }
 
-  d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
+  c.r_bit = StoredColorBits(c.r_bit);
+  c.g_bit = StoredColorBits(c.g_bit);
+  c.b_bit = StoredColorBits(c.b_bit);
+
+  c.mask = ~(c.r_bit | c.g_bit | c.b_bit);
+  const uint32_t color_class = map->GetColorClass(c);
+
+  // All pixels of the row are in consecutive columns of the same bitplane.
+  const int32_t first_word = ValueAt(y % double_rows_, 0, lowest_bitplane_)
+    - bitplane_buffer_;
+  PixelDesignator *d = map->get(0, y);
+  for (int x = 0; x < columns_; ++x, ++d) {
+    d->gpio_word = first_word + x;
+    d->color_class = color_class;
+  }
+}
+
+gpio_bits_t Framebuffer::StoredColorBits(gpio_bits_t bits) const {
+#ifdef COMPACT_FRAMEBUFFER
+  gpio_bits_t compact_order[kCompactColorBits];
+  GetCompactColorOrder(*hardware_mapping_, compact_order);
+  gpio_bits_t result = 0;
+  for (int i = 0; i < kCompactColorBits; ++i) {
+    if (bits & compact_order[i]) result |= 1u << i;
+  }
+  return result;
+#else
+  return native_layout_ ? native_io_->NativeBits(bits) : bits;
+#endif
 }
 
 void Framebuffer::Serialize(const char **data, size_t *len) const {
@@ -799,80 +1441,180 @@ void Framebuffer::Serialize(const char **data, size_t *len) const {
 bool Framebuffer::Deserialize(const char *data, size_t len) {
   if (len != buffer_size_) return false;
   memcpy(bitplane_buffer_, data, len);
+  UpdateRowSummaries();
   return true;
 }
 
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
   memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
+  memcpy(nonblank_columns_, other->nonblank_columns_,
+         sizeof(*nonblank_columns_) * double_rows_ * stored_bitplanes_);
+  memcpy(signatures_, other->signatures_,
+         sizeof(*signatures_) * double_rows_ * stored_bitplanes_);
 }
 
-void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
-  const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
-  color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
-  if (parallel_ >= 2) {
-    color_clk_mask |= h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2;
-  }
-  if (parallel_ >= 3) {
-    color_clk_mask |= h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2;
-  }
-  if (parallel_ >= 4) {
-    color_clk_mask |= h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2;
-  }
-  if (parallel_ >= 5) {
-    color_clk_mask |= h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2;
-  }
-  if (parallel_ >= 6) {
-    color_clk_mask |= h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2;
+void Framebuffer::FindIdenticalRows(int start_bit, int group_size,
+                                    uint32_t *row_bits) {
+  const size_t compare_bytes = (columns_ * (bitplanes_ - start_bit)
+                                * sizeof(plane_bits_t));
+  for (int row = 0; row < double_rows_; ++row) {
+    row_bits[row] = 1u << (row % group_size);
+    for (int other = row - row % group_size; other < row; ++other) {
+      if (row_bits[other] == 0)
+        continue;  // Lit with an earlier row, which we compared already.
+      bool same = true;
+      for (int b = start_bit; b < bitplanes_ && same; ++b) {
+        same = (*SignatureAt(row, b) == *SignatureAt(other, b));
+      }
+      // Signatures are the same for the same data, but not only then.
+      if (same && memcmp(ValueAt(row, 0, start_bit),
+                         ValueAt(other, 0, start_bit), compare_bytes) == 0) {
+        row_bits[other] |= row_bits[row];
+        row_bits[row] = 0;
+        break;
+      }
+    }
   }
+}
 
-  color_clk_mask |= h.clock;
+template <class RowSetter>
+void Framebuffer::SelectDumpRows() {
+  sKeepSignatures = sSkipReclock || RowSetter::kRowGroupSize > 1;
+  dump_rows_[0][0] = &Framebuffer::DumpRows<RowSetter, false, false>;
+  dump_rows_[0][1] = &Framebuffer::DumpRows<RowSetter, false, true>;
+  dump_rows_[1][0] = &Framebuffer::DumpRows<RowSetter, true, false>;
+  dump_rows_[1][1] = &Framebuffer::DumpRows<RowSetter, true, true>;
+}
 
+int Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
   // Depending if we do dithering, we might not always show the lowest bits.
-  const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
-
-  const uint8_t half_double = double_rows_/2;
-  for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
-    uint8_t d_row;
-    switch (scan_mode_) {
-    case 0:  // progressive
-    default:
-      d_row = row_loop;
-      break;
+  int start_bit = std::max(pwm_low_bit, bitplanes_ - pwm_bits_);
+
+  if (sSkipReclock && sShiftRegisterData == NULL) {
+    sShiftRegisterData = new plane_bits_t[columns_];
+  }
 
-    case 1:  // interlaced
-      d_row = ((row_loop < half_double)
-               ? (row_loop << 1)
-               : ((row_loop - half_double) << 1) + 1);
+  // The refresh brightness only changes between frames. Lower ones leave
+  // out the lowest bitplanes, but never the top one.
+  const int refresh_brightness = sRefreshBrightness;
+  start_bit = std::max(start_bit, std::min(sRefreshLowBit[refresh_brightness],
+                                           bitplanes_ - 1));
+  const int first_pulse = (100 - refresh_brightness) * kMaxBitPlanes;
+
+  const bool interlaced = (scan_mode_ == 1);
+  return (this->*dump_rows_[native_layout_][interlaced])(io, start_bit,
+                                                         first_pulse);
+}
+
+template <class RowSetter, bool kNativeLayout, bool kInterlaced>
+int Framebuffer::DumpRows(GPIO *io, int start_bit, int first_pulse) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  RowSetter *const row_setter = static_cast<RowSetter*>(row_setter_);
+  const gpio_bits_t color_clk_mask = color_clk_mask_;
+  int unchanged_planes = 0;
+
+  // Rows with the same content can be lit together if the panel allows.
+  uint32_t row_bits[32];
+  if (RowSetter::kRowGroupSize > 1) {
+    assert(double_rows_ <= 32);
+    FindIdenticalRows(start_bit, RowSetter::kRowGroupSize, row_bits);
+  }
+
+  const int half_double = double_rows_/2;
+  for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+    const int d_row = !kInterlaced
+      ? row_loop
+      : ((row_loop < half_double)
+         ? (row_loop << 1)
+         : ((row_loop - half_double) << 1) + 1);
+
+    // Rows lit at the same time share the current of the column drivers, so
+    // each bitplane is pulsed once for each of them to keep their brightness.
+    int lit_rows = 1;
+    if (RowSetter::kRowGroupSize > 1) {
+      if (row_bits[d_row] == 0)
+        continue;  // Already lit with an earlier row of its group.
+      lit_rows = 0;
+      for (uint32_t bits = row_bits[d_row]; bits; bits &= bits - 1) {
+        ++lit_rows;
+      }
     }
 
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
-    for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
-      // While the output enable is still on, we can already clock in the next
-      // data.
-      for (int col = 0; col < columns_; ++col) {
-        const gpio_bits_t &out = *row_data++;
-        io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
-        io->SetBits(h.clock);               // Rising edge: clock color in.
+    for (int b = start_bit; b < bitplanes_; ++b) {
+      const plane_bits_t *row_data = ValueAt(d_row, 0, b);
+
+      // No need to clock in what is already in the shift registers.
+      const bool blank = (*NonblankColumnsAt(d_row, b) == 0);
+      const uint32_t signature = *SignatureAt(d_row, b);
+      bool unchanged = false;
+      if (sShiftRegistersKnown) {
+        if (blank || sShiftRegistersBlank) {
+          unchanged = (blank == sShiftRegistersBlank);
+        } else if (sSkipReclock && signature == sShiftRegisterSignature) {
+          unchanged = (memcmp(row_data, sShiftRegisterData,
+                              columns_ * sizeof(*row_data)) == 0);
+        }
+      }
+
+      if (unchanged) {
+        ++unchanged_planes;
+      } else {
+        if (sSkipReclock && !blank) {
+          // Clock in the copy, so it is exactly what is in the shift registers
+          // even if the framebuffer is written to meanwhile.
+          memcpy(sShiftRegisterData, row_data, columns_ * sizeof(*row_data));
+          row_data = sShiftRegisterData;
+        }
+        // While the output enable is still on, we can already clock in the
+        // next data.
+        for (int col = 0; col < columns_; col += kPulsePollColumns) {
+          const int end_col = std::min(col + kPulsePollColumns, columns_);
+          for (int c = col; c < end_col; ++c) {
+            // A blank plane is clocked in as zeros, not from the framebuffer,
+            // so it is still blank if a pixel is set meanwhile.
+            const gpio_bits_t out = blank ? 0 : ExpandColorBits(*row_data++);
+            if (kNativeLayout) {
+              io->WriteNativeBitsAndClock(out, native_color_mask_, h.clock);
+            } else {
+              // col + reset clock, then rising edge: clock color in.
+              io->WriteMaskedBitsAndClock(out, color_clk_mask, h.clock);
+            }
+          }
+          sOutputEnablePulser->PollPulse();
+        }
+        io->ClearBits(color_clk_mask);    // clock back to normal.
       }
-      io->ClearBits(color_clk_mask);    // clock back to normal.
+      sShiftRegistersKnown = true;
+      sShiftRegistersBlank = blank;
+      sShiftRegisterSignature = signature;
 
       // OE of the previous row-data must be finished before strobe.
       sOutputEnablePulser->WaitPulseFinished();
 
       // Setting address and strobing needs to happen in dark time.
-      row_setter_->SetRowAddress(io, d_row);
+      if (RowSetter::kRowGroupSize > 1) {
+        row_setter->RowSetter::SetRowGroupAddress(io, d_row, row_bits[d_row]);
+      } else {
+        row_setter->RowSetter::SetRowAddress(io, d_row);
+      }
 
       io->SetBits(h.strobe);   // Strobe in the previously clocked in row.
       io->ClearBits(h.strobe);
 
       // Now switch on for the sleep time necessary for that bit-plane.
-      sOutputEnablePulser->SendPulse(b);
+      sOutputEnablePulser->SendPulse(first_pulse + b);
+      for (int i = 1; i < lit_rows; ++i) {
+        sOutputEnablePulser->WaitPulseFinished();
+        sOutputEnablePulser->SendPulse(first_pulse + b);
+      }
     }
   }
+  // Don't leave the last row lit while the caller waits for the next frame.
+  sOutputEnablePulser->WaitPulseFinished();
+  return unchanged_planes;
 }
 }  // namespace internal
 }  // namespace rgb_matrix
@@ -0,0 +1,175 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// The hardware independent part of the GPIO: bookkeeping of used bits and
+// choosing the GPIOBackend.
+
+#include "gpio.h"
+#include "gpio-backend.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Backend to use if we can't tell from the system which hardware we're
+// running on.
+#ifndef RGB_DEFAULT_GPIO_BACKEND
+#  define RGB_DEFAULT_GPIO_BACKEND "bcm"
+#endif
+
+namespace rgb_matrix {
+// Backend of the last GPIO::Init(); used for GetMicrosecondCounter().
+static GPIOBackend *s_timing_backend = NULL;
+
+// Read file, with all '\0' replaced by space, so that we can strstr() in
+// device tree lists.
+static bool ReadFileAsString(const char *filename, char *buffer, size_t size) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) return false;
+  ssize_t r = read(fd, buffer, size - 1); // assume one read enough
+  close(fd);
+  if (r <= 0) return false;
+  for (ssize_t i = 0; i < r; ++i) {
+    if (buffer[i] == '\0') buffer[i] = ' ';
+  }
+  buffer[r] = '\0';
+  return true;
+}
+
+static const char *DetectBackendName() {
+  char buffer[4096];
+  if (ReadFileAsString("/proc/device-tree/compatible", buffer, sizeof(buffer))) {
+    if (strstr(buffer, "rockchip,rk3288")) return "rk3288";
+    if (strstr(buffer, "brcm,bcm")) return "bcm";
+  }
+  // Android typically doesn't let us see the device tree.
+  if (ReadFileAsString("/proc/cpuinfo", buffer, sizeof(buffer))) {
+    if (strstr(buffer, "Rockchip") || strstr(buffer, "rk3288")) return "rk3288";
+    if (strstr(buffer, "BCM2")) return "bcm";
+  }
+  return RGB_DEFAULT_GPIO_BACKEND;
+}
+
+GPIOBackend *GPIOBackend::Create(const char *name) {
+  if (name == NULL || strcmp(name, "auto") == 0)
+    name = DetectBackendName();
+
+  if (strcasecmp(name, "bcm") == 0)
+    return CreateBcmGPIOBackend();
+  if (strcasecmp(name, "rk3288") == 0)
+    return CreateRockchipGPIOBackend();
+  if (strcasecmp(name, "simulated") == 0)
+    return CreateSimulatedGPIOBackend();
+  return NULL;
+}
+
+const char *GPIOBackend::AvailableNames() {
+  return "auto, bcm, rk3288, simulated";
+}
+
+// Slow operating-system way to get the time.
+static uint32_t SystemMicrosecondCounter() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const uint64_t micros = ts.tv_nsec / 1000;
+  const uint64_t epoch_usec = (uint64_t)ts.tv_sec * 1000000 + micros;
+  return epoch_usec & 0xFFFFFFFF;
+}
+
+uint32_t GPIOBackend::GetMicrosecondCounter() {
+  return SystemMicrosecondCounter();
+}
+
+GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
+               slowdown_(1), backend_(NULL) {
+}
+
+bool GPIO::Init(int slowdown, const char *backend) {
+  slowdown_ = slowdown;
+
+  if (backend_ == NULL) {
+    backend_ = GPIOBackend::Create(backend);
+    if (backend_ == NULL) {
+      fprintf(stderr, "Unknown GPIO backend '%s'. Available: %s\n",
+              backend ? backend : "auto", GPIOBackend::AvailableNames());
+      return false;
+    }
+  }
+
+  // Pre-mmap all registers we need now and possibly in the future, as to
+  // allow dropping privileges after GPIO::Init() even as some of these
+  // registers might be needed later.
+  if (!backend_->Init())
+    return false;
+
+  s_timing_backend = backend_;
+  return true;
+}
+
+bool GPIO::SetHardwareMapping(const struct HardwareMapping &mapping) {
+  if (backend_ == NULL) {
+    fprintf(stderr, "Attempt to set mapping but not yet Init()-ialized.\n");
+    return false;
+  }
+  return backend_->SetHardwareMapping(mapping);
+}
+
+gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
+                              bool adafruit_pwm_transition_hack_needed) {
+  if (backend_ == NULL) {
+    fprintf(stderr, "Attempt to init outputs but not yet Init()-ialized.\n");
+    return 0;
+  }
+
+  if (adafruit_pwm_transition_hack_needed) {
+    reserved_bits_ = backend_->PrepareAdafruitPwmTransition() & ~outputs;
+  }
+
+  outputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+  outputs = backend_->ConfigureOutputs(outputs);
+  output_bits_ |= outputs;
+  return outputs;
+}
+
+gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
+  if (backend_ == NULL) {
+    fprintf(stderr, "Attempt to init inputs but not yet Init()-ialized.\n");
+    return 0;
+  }
+
+  inputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+  inputs = backend_->ConfigureInputs(inputs);
+  input_bits_ |= inputs;
+  return inputs;
+}
+
+// Public PinPulser factory
+PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
+                             bool allow_hardware_pulsing,
+                             const std::vector<int> &nano_wait_spec) {
+  if (io->backend() == NULL) return NULL;
+  return io->backend()->CreatePinPulser(io, gpio_mask, allow_hardware_pulsing,
+                                        nano_wait_spec);
+}
+
+// For external use, e.g. in the matrix for extra time.
+uint32_t GetMicrosecondCounter() {
+  if (s_timing_backend) return s_timing_backend->GetMicrosecondCounter();
+  return SystemMicrosecondCounter();
+}
+
+}  // namespace rgb_matrix
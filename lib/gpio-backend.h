@@ -0,0 +1,118 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_GPIO_BACKEND_H
+#define RPI_GPIO_BACKEND_H
+
+#include "gpio-bits.h"
+
+#include <vector>
+
+struct HardwareMapping;
+
+namespace rgb_matrix {
+class GPIO;
+class PinPulser;
+
+// The hardware specific part of a GPIO. The GPIO class takes care of the
+// bookkeeping of which bits are in use and of the slowdown; a backend only
+// knows how to get bits to the pins of a particular SoC.
+//
+// All bits are given in the Raspberry Pi GPIO numbering used by the
+// hardware mappings; a backend for another SoC translates them.
+class GPIOBackend {
+public:
+  // Create the backend with the given name or NULL if there is no such
+  // backend. If "name" is NULL or "auto", the backend is chosen by looking
+  // at the hardware we're running on.
+  static GPIOBackend *Create(const char *name);
+
+  // Comma separated list of the available backend names; for help texts.
+  static const char *AvailableNames();
+
+  virtual ~GPIOBackend() {}
+
+  virtual const char *name() const = 0;
+
+  // Map registers and whatever else is needed. Might be called more than
+  // once. Returns 'false' if the hardware can't be accessed (typically: not
+  // running as root or not running on this SoC).
+  virtual bool Init() = 0;
+
+  // Tell the backend which HardwareMapping the bits come from. Backends that
+  // need to translate bits to their own pins look up their wiring for it.
+  // Returns 'false' if this mapping is not supported.
+  virtual bool SetHardwareMapping(const struct HardwareMapping &mapping) {
+    return true;
+  }
+
+  // Configure pins as output or input. Return the bits that could be
+  // configured.
+  virtual gpio_bits_t ConfigureOutputs(gpio_bits_t outputs) = 0;
+  virtual gpio_bits_t ConfigureInputs(gpio_bits_t inputs) = 0;
+
+  // The Adafruit HAT with PWM hack has two outputs soldered together; make
+  // sure the old one is not driven. Returns the bits that need to be
+  // reserved because of that.
+  virtual gpio_bits_t PrepareAdafruitPwmTransition() { return 0; }
+
+  // The register writes. Semantics are the same as of the corresponding
+  // GPIO methods, without slowdown.
+  virtual void SetBits(gpio_bits_t value) = 0;
+  virtual void ClearBits(gpio_bits_t value) = 0;
+  virtual void WriteMaskedBits(gpio_bits_t value, gpio_bits_t mask) = 0;
+  virtual void WriteMaskedBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) = 0;
+  virtual gpio_bits_t Read() const = 0;
+
+  // While "force" is set, every write has to reach the pins even if it does
+  // not change any of them: GPIO repeats writes to hold the pins longer (the
+  // slowdown). Only backends that leave out such writes need to care.
+  virtual void SetForceStores(bool force) {}
+
+  // Optional native layout for color data. Backends that translate bits can
+  // instead take values as they are stored to one of their data registers,
+  // so nothing needs to be translated while clocking in columns.
+  // Returns 'false' if "colors" can't be written with a single register
+  // (or the backend doesn't need this). Otherwise, NativeBits() translates
+  // bits within "colors" to that register and the WriteNative*() functions
+  // take "value" and "mask" in that layout; "clock" stays a regular bit.
+  virtual bool UseNativeColorLayout(gpio_bits_t colors) { return false; }
+  virtual gpio_bits_t NativeBits(gpio_bits_t bits) const { return bits; }
+  virtual void WriteNativeBits(gpio_bits_t value, gpio_bits_t mask) {
+    WriteMaskedBits(value, mask);
+  }
+  virtual void WriteNativeBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) {
+    WriteMaskedBitsAndClock(value, mask | clock, clock);
+  }
+
+  // Create the PinPulser that fits this hardware. See PinPulser::Create().
+  virtual PinPulser *CreatePinPulser(GPIO *io, gpio_bits_t gpio_mask,
+                                     bool allow_hardware_pulsing,
+                                     const std::vector<int> &nano_wait_spec) = 0;
+
+  // Rolling over microsecond counter. The default implementation asks the
+  // operating system.
+  virtual uint32_t GetMicrosecondCounter();
+};
+
+// The available backends.
+GPIOBackend *CreateBcmGPIOBackend();        // Raspberry Pi; gpio.cc
+GPIOBackend *CreateRockchipGPIOBackend();   // RK3288; gpio_rk3288.cc
+GPIOBackend *CreateSimulatedGPIOBackend();  // RAM only; gpio-simulated.cc
+
+}  // end namespace rgb_matrix
+
+#endif  // RPI_GPIO_BACKEND_H
@@ -0,0 +1,102 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "gpio-simulated.h"
+#include "gpio.h"
+
+#include <string.h>
+
+namespace rgb_matrix {
+// Output-enable is active low: a pulse clears the bits, accounts for the
+// time the LEDs would be on, and sets them again.
+class SimulatedGPIOBackend::Pulser : public PinPulser {
+public:
+  Pulser(GPIO *io, SimulatedGPIOBackend *backend, gpio_bits_t bits,
+         const std::vector<int> &nano_specs)
+    : io_(io), backend_(backend), bits_(bits), nano_specs_(nano_specs) {}
+
+  virtual void SendPulse(int time_spec_number) {
+    io_->ClearBits(bits_);
+    backend_->pulses_++;
+    backend_->pulse_nanos_ += nano_specs_[time_spec_number];
+    io_->SetBits(bits_);
+  }
+
+private:
+  GPIO *const io_;
+  SimulatedGPIOBackend *const backend_;
+  const gpio_bits_t bits_;
+  const std::vector<int> nano_specs_;
+};
+
+SimulatedGPIOBackend::SimulatedGPIOBackend()
+  : outputs_(0), input_levels_(0), native_shift_(0) {
+  memset(registers_, 0, sizeof(registers_));
+  ResetStatistics();
+}
+
+gpio_bits_t SimulatedGPIOBackend::ConfigureOutputs(gpio_bits_t outputs) {
+  outputs_ |= outputs;
+  return outputs;
+}
+
+gpio_bits_t SimulatedGPIOBackend::ConfigureInputs(gpio_bits_t inputs) {
+  outputs_ &= ~inputs;
+  return inputs;
+}
+
+bool SimulatedGPIOBackend::UseNativeColorLayout(gpio_bits_t colors) {
+  if (colors == 0) return false;
+  int r = 0;
+  while (static_cast<uint32_t>(colors >> (32 * r)) == 0) ++r;
+  if (((colors >> (32 * r)) & ~static_cast<gpio_bits_t>(0xffffffff)) != 0)
+    return false;  // Spread over more than one register.
+  native_shift_ = 32 * r;
+  return true;
+}
+
+gpio_bits_t SimulatedGPIOBackend::pins() const {
+  gpio_bits_t result = 0;
+  for (int r = 0; r < kRegisterCount; ++r) {
+    result |= static_cast<gpio_bits_t>(registers_[r]) << (32 * r);
+  }
+  return result;
+}
+
+void SimulatedGPIOBackend::Store(gpio_bits_t value, gpio_bits_t touched) {
+  for (int r = 0; r < kRegisterCount; ++r) {
+    if (static_cast<uint32_t>(touched >> (32 * r)) == 0)
+      continue;
+    registers_[r] = static_cast<uint32_t>(value >> (32 * r));
+    stores_++;
+  }
+}
+
+void SimulatedGPIOBackend::ResetStatistics() {
+  stores_ = 0;
+  clock_edges_ = 0;
+  pulses_ = 0;
+  pulse_nanos_ = 0;
+}
+
+PinPulser *SimulatedGPIOBackend::CreatePinPulser(
+  GPIO *io, gpio_bits_t gpio_mask, bool allow_hardware_pulsing,
+  const std::vector<int> &nano_wait_spec) {
+  return new Pulser(io, this, gpio_mask, nano_wait_spec);
+}
+
+GPIOBackend *CreateSimulatedGPIOBackend() {
+  return new SimulatedGPIOBackend();
+}
+}  // end namespace rgb_matrix
@@ -0,0 +1,107 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_GPIO_SIMULATED_H
+#define RPI_GPIO_SIMULATED_H
+
+#include "gpio-backend.h"
+
+namespace rgb_matrix {
+// A GPIOBackend without hardware: the pins live in a register file in RAM.
+// It behaves like a port with plain data registers, 32 pins per register,
+// and counts every store to a register and every pulse. That allows running
+// and benchmarking the refresh on any Linux box.
+//
+// Pulses are not timed; their requested length is just added up, so the
+// refresh runs as fast as the CPU allows.
+class SimulatedGPIOBackend : public GPIOBackend {
+public:
+  static const int kRegisterCount = (sizeof(gpio_bits_t) + 3) / 4;
+
+  SimulatedGPIOBackend();
+
+  virtual const char *name() const { return "simulated"; }
+  virtual bool Init() { return true; }
+  virtual gpio_bits_t ConfigureOutputs(gpio_bits_t outputs);
+  virtual gpio_bits_t ConfigureInputs(gpio_bits_t inputs);
+
+  virtual void SetBits(gpio_bits_t value) {
+    Store(pins() | value, value);
+  }
+  virtual void ClearBits(gpio_bits_t value) {
+    Store(pins() & ~value, value);
+  }
+  virtual void WriteMaskedBits(gpio_bits_t value, gpio_bits_t mask) {
+    Store((pins() & ~mask) | (value & mask), mask);
+  }
+  virtual void WriteMaskedBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) {
+    WriteMaskedBits(value & ~clock, mask);
+    SetBits(clock);
+    ++clock_edges_;
+  }
+  virtual gpio_bits_t Read() const { return input_levels_; }
+
+  // The native layout is the content of a single register.
+  virtual bool UseNativeColorLayout(gpio_bits_t colors);
+  virtual gpio_bits_t NativeBits(gpio_bits_t bits) const {
+    return static_cast<uint32_t>(bits >> native_shift_);
+  }
+  virtual void WriteNativeBits(gpio_bits_t value, gpio_bits_t mask) {
+    WriteMaskedBits(value << native_shift_, mask << native_shift_);
+  }
+  virtual void WriteNativeBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) {
+    WriteMaskedBitsAndClock(value << native_shift_,
+                            (mask << native_shift_) | clock, clock);
+  }
+
+  virtual PinPulser *CreatePinPulser(GPIO *io, gpio_bits_t gpio_mask,
+                                     bool allow_hardware_pulsing,
+                                     const std::vector<int> &nano_wait_spec);
+
+  // Levels as seen from the outside on input pins.
+  void set_input_levels(gpio_bits_t levels) { input_levels_ = levels; }
+
+  // The current state of the output pins and the register file itself.
+  gpio_bits_t pins() const;
+  const uint32_t *registers() const { return registers_; }
+  gpio_bits_t outputs() const { return outputs_; }
+
+  // Statistics.
+  uint64_t stores() const { return stores_; }
+  uint64_t clock_edges() const { return clock_edges_; }
+  uint64_t pulses() const { return pulses_; }
+  uint64_t pulse_nanos() const { return pulse_nanos_; }
+  void ResetStatistics();
+
+private:
+  class Pulser;
+
+  // Write "value" to all the registers that contain any of the "touched" bits.
+  void Store(gpio_bits_t value, gpio_bits_t touched);
+
+  uint32_t registers_[kRegisterCount];
+  gpio_bits_t outputs_;
+  gpio_bits_t input_levels_;
+  int native_shift_;
+
+  uint64_t stores_;
+  uint64_t clock_edges_;
+  uint64_t pulses_;
+  uint64_t pulse_nanos_;
+};
+}  // end namespace rgb_matrix
+
+#endif  // RPI_GPIO_SIMULATED_H
@@ -17,6 +17,7 @@
 #include <inttypes.h>
 
 #include "gpio.h"
+#include "gpio-backend.h"
 
 #include <assert.h>
 #include <fcntl.h>
@@ -127,21 +128,79 @@ static volatile uint32_t *s_CLK_registers = NULL;
 namespace rgb_matrix {
 #define GPIO_BIT(x) (1ull << x)
 
-GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
-               slowdown_(1)
+// The Raspberry Pi GPIO. Has separate set and clear registers, so there is
+// no need to remember any state.
+class BcmGPIOBackend : public GPIOBackend {
+public:
+  BcmGPIOBackend()
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-             , uses_64_bit_(false)
+    : uses_64_bit_(false)
 #endif
-{
-}
+  {}
 
-gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
-                              bool adafruit_pwm_transition_hack_needed) {
-  if (s_GPIO_registers == NULL) {
-    fprintf(stderr, "Attempt to init outputs but not yet Init()-ialized.\n");
-    return 0;
+  virtual const char *name() const { return "bcm"; }
+  virtual bool Init();
+  virtual gpio_bits_t ConfigureOutputs(gpio_bits_t outputs);
+  virtual gpio_bits_t ConfigureInputs(gpio_bits_t inputs);
+  virtual gpio_bits_t PrepareAdafruitPwmTransition();
+
+  virtual void SetBits(gpio_bits_t value) {
+    *gpio_set_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+    if (uses_64_bit_)
+      *gpio_set_bits_high_ = static_cast<uint32_t>(value >> 32);
+#endif
+  }
+
+  virtual void ClearBits(gpio_bits_t value) {
+    *gpio_clr_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+    if (uses_64_bit_)
+      *gpio_clr_bits_high_ = static_cast<uint32_t>(value >> 32);
+#endif
   }
 
+  virtual void WriteMaskedBits(gpio_bits_t value, gpio_bits_t mask) {
+    // Writing a word is two operations. The IO is actually pretty slow, so
+    // this should probably  be unnoticable.
+    ClearBits(~value & mask);
+    SetBits(value & mask);
+  }
+
+  virtual void WriteMaskedBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) {
+    ClearBits(~value & mask);   // includes the clock.
+    SetBits(value & mask & ~clock);
+    SetBits(clock);
+  }
+
+  virtual gpio_bits_t Read() const {
+    return (static_cast<gpio_bits_t>(*gpio_read_bits_low_)
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+            | (static_cast<gpio_bits_t>(*gpio_read_bits_high_) << 32)
+#endif
+            );
+  }
+
+  virtual PinPulser *CreatePinPulser(GPIO *io, gpio_bits_t gpio_mask,
+                                     bool allow_hardware_pulsing,
+                                     const std::vector<int> &nano_wait_spec);
+  virtual uint32_t GetMicrosecondCounter();
+
+private:
+  volatile uint32_t *gpio_set_bits_low_;
+  volatile uint32_t *gpio_clr_bits_low_;
+  volatile uint32_t *gpio_read_bits_low_;
+
+#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
+  bool uses_64_bit_;
+  volatile uint32_t *gpio_set_bits_high_;
+  volatile uint32_t *gpio_clr_bits_high_;
+  volatile uint32_t *gpio_read_bits_high_;
+#endif
+};
+
+gpio_bits_t BcmGPIOBackend::PrepareAdafruitPwmTransition() {
   // Hack: for the PWM mod, the user soldered together GPIO 18 (new OE)
   // with GPIO 4 (old OE).
   // Since they are connected inside the HAT, want to make extra sure that,
@@ -151,16 +210,15 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
   // So explicitly set both of these pins as input initially, so the user
   // can switch between the two modes "adafruit-hat" and "adafruit-hat-pwm"
   // without trouble.
-  if (adafruit_pwm_transition_hack_needed) {
-    INP_GPIO(4);
-    INP_GPIO(18);
-    // Even with PWM enabled, GPIO4 still can not be used, because it is
-    // now connected to the GPIO18 and thus must stay an input.
-    // So reserve this bit if it is not set in outputs.
-    reserved_bits_ = GPIO_BIT(4) & ~outputs;
-  }
+  INP_GPIO(4);
+  INP_GPIO(18);
+  // Even with PWM enabled, GPIO4 still can not be used, because it is
+  // now connected to the GPIO18 and thus must stay an input.
+  // So reserve this bit if it is not set in outputs.
+  return GPIO_BIT(4);
+}
 
-  outputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+gpio_bits_t BcmGPIOBackend::ConfigureOutputs(gpio_bits_t outputs) {
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
   const int kMaxAvailableBit = 45;
   uses_64_bit_ |= (outputs >> 32) != 0;
@@ -173,17 +231,10 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
       OUT_GPIO(b);
     }
   }
-  output_bits_ |= outputs;
   return outputs;
 }
 
-gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
-  if (s_GPIO_registers == NULL) {
-    fprintf(stderr, "Attempt to init inputs but not yet Init()-ialized.\n");
-    return 0;
-  }
-
-  inputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
+gpio_bits_t BcmGPIOBackend::ConfigureInputs(gpio_bits_t inputs) {
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
   const int kMaxAvailableBit = 45;
   uses_64_bit_ |= (inputs >> 32) != 0;
@@ -195,7 +246,6 @@ gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
       INP_GPIO(b);
     }
   }
-  input_bits_ |= inputs;
   return inputs;
 }
 
@@ -230,10 +280,12 @@ static RaspberryPiModel DetermineRaspberryModel() {
     return PI_MODEL_3;
   }
   unsigned int pi_revision;
-  /*if (sscanf(index(revision_key, ':') + 1, "%x", &pi_revision) != 1) {
+  const char *revision_value = strchr(revision_key, ':');
+  if (revision_value == NULL
+      || sscanf(revision_value + 1, "%x", &pi_revision) != 1) {
     fprintf(stderr, "Unknown Revision: Could not determine Pi model\n");
     return PI_MODEL_3;
-  }*/
+  }
 
   // https://www.raspberrypi.org/documentation/hardware/raspberrypi/revision-codes/README.md
   const unsigned pi_type = (pi_revision >> 4) & 0xff;
@@ -335,9 +387,7 @@ static bool mmap_all_bcm_registers_once() {
   return true;
 }
 
-bool GPIO::Init(int slowdown) {
-  slowdown_ = slowdown;
-
+bool BcmGPIOBackend::Init() {
   // Pre-mmap all bcm registers we need now and possibly in the future, as to
   // allow  dropping privileges after GPIO::Init() even as some of these
   // registers might be needed later.
@@ -357,30 +407,6 @@ bool GPIO::Init(int slowdown) {
   return true;
 }
 
-inline GPIO::gpio_bits_t ReadRegisters() const {
-    return (static_cast<gpio_bits_t>(*gpio_read_bits_low_)
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-            | (static_cast<gpio_bits_t>(*gpio_read_bits_low_) << 32)
-#endif
-            );
-  }
-
-inline void GPIO::WriteSetBits(gpio_bits_t value) {
-    *gpio_set_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-    if (uses_64_bit_)
-      *gpio_set_bits_high_ = static_cast<uint32_t>(value >> 32);
-#endif
-  }
-
-inline void GPIO::WriteClrBits(gpio_bits_t value) {
-    *gpio_clr_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-    if (uses_64_bit_)
-      *gpio_clr_bits_high_ = static_cast<uint32_t>(value >> 32);
-#endif
-  }
-
 /*
  * We support also other pinouts that don't have the OE- on the hardware
  * PWM output pin, so we need to provide (impefect) 'manual' timing as well.
@@ -784,10 +810,9 @@ private:
 
 } // end anonymous namespace
 
-// Public PinPulser factory
-PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
-                             bool allow_hardware_pulsing,
-                             const std::vector<int> &nano_wait_spec) {
+PinPulser *BcmGPIOBackend::CreatePinPulser(
+  GPIO *io, gpio_bits_t gpio_mask, bool allow_hardware_pulsing,
+  const std::vector<int> &nano_wait_spec) {
   if (!Timers::Init()) return NULL;
   if (allow_hardware_pulsing && HardwarePinPulser::CanHandle(gpio_mask)) {
     return new HardwarePinPulser(gpio_mask, nano_wait_spec);
@@ -796,17 +821,16 @@ PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
   }
 }
 
-// For external use, e.g. in the matrix for extra time.
-uint32_t GetMicrosecondCounter() {
+uint32_t BcmGPIOBackend::GetMicrosecondCounter() {
   if (s_Timer1Mhz) return *s_Timer1Mhz;
 
   // When run as non-root, we can't read the timer. Fall back to slow
   // operating-system ways.
-  struct timespec ts;
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  const uint64_t micros = ts.tv_nsec / 1000;
-  const uint64_t epoch_usec = (uint64_t)ts.tv_sec * 1000000 + micros;
-  return epoch_usec & 0xFFFFFFFF;
+  return GPIOBackend::GetMicrosecondCounter();
+}
+
+GPIOBackend *CreateBcmGPIOBackend() {
+  return new BcmGPIOBackend();
 }
 
 } // namespace rgb_matrix
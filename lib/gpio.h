@@ -17,27 +17,41 @@
 #define RPI_GPIO_INTERNAL_H
 
 #include "gpio-bits.h"
+#include "gpio-backend.h"
 
+#include <stddef.h>
 #include <vector>
 
 // Putting this in our namespace to not collide with other things called like
 // this.
 namespace rgb_matrix {
 // For now, everything is initialized as output.
+//
+// The actual register access is done by a GPIOBackend, chosen in Init().
 class GPIO {
 public:
   GPIO();
 
   // Initialize before use. Returns 'true' if successful, 'false' otherwise
   // (e.g. due to a permission problem).
+  // "backend" is the name of the GPIOBackend to use; NULL or "auto" detects
+  // the hardware we're running on.
   bool Init(int
 #if RGB_SLOWDOWN_GPIO
             slowdown = RGB_SLOWDOWN_GPIO
 #else
             slowdown = 1
 #endif
-      );
+            , const char *backend = NULL);
+
+  // Use "backend" instead of the one Init() would choose, e.g. a
+  // SimulatedGPIOBackend that is looked at afterwards. Call before Init().
+  void SetBackend(GPIOBackend *backend) { backend_ = backend; }
 
+  // Set the HardwareMapping the bits given to this GPIO are from. Needs to
+  // be called before InitOutputs(). Returns 'false' if the hardware can't
+  // output that mapping.
+  bool SetHardwareMapping(const struct HardwareMapping &mapping);
 
   // Initialize outputs.
   // Returns the bits that were available and could be set for output.
@@ -53,54 +67,121 @@ public:
   // Set the bits that are '1' in the output. Leave the rest untouched.
   inline void SetBits(gpio_bits_t value) {
     if (!value) return;
-    WriteSetBits(value);
-    for (int i = 0; i < slowdown_; ++i) {
-      WriteSetBits(value);
+    backend_->SetBits(value);
+    if (slowdown_ > 0) {
+      backend_->SetForceStores(true);
+      for (int i = 0; i < slowdown_; ++i) {
+        backend_->SetBits(value);
+      }
+      backend_->SetForceStores(false);
+    }
+  }
+
+  // Like SetBits(), but the bits are written even if they are already set,
+  // to hold them longer.
+  inline void RepeatSetBits(gpio_bits_t value) {
+    if (!value) return;
+    backend_->SetForceStores(true);
+    for (int i = 0; i <= slowdown_; ++i) {
+      backend_->SetBits(value);
     }
+    backend_->SetForceStores(false);
   }
 
   // Clear the bits that are '1' in the output. Leave the rest untouched.
   inline void ClearBits(gpio_bits_t value) {
     if (!value) return;
-    WriteClrBits(value);
-    for (int i = 0; i < slowdown_; ++i) {
-      WriteClrBits(value);
+    backend_->ClearBits(value);
+    if (slowdown_ > 0) {
+      backend_->SetForceStores(true);
+      for (int i = 0; i < slowdown_; ++i) {
+        backend_->ClearBits(value);
+      }
+      backend_->SetForceStores(false);
     }
   }
 
   // Write all the bits of "value" mentioned in "mask". Leave the rest untouched.
   inline void WriteMaskedBits(gpio_bits_t value, gpio_bits_t mask) {
-    // Writing a word is two operations. The IO is actually pretty slow, so
-    // this should probably  be unnoticable.
-    ClearBits(~value & mask);
-    SetBits(value & mask);
+    if (!mask) return;
+    backend_->WriteMaskedBits(value, mask);
+    if (slowdown_ > 0) {
+      backend_->SetForceStores(true);
+      for (int i = 0; i < slowdown_; ++i) {
+        backend_->WriteMaskedBits(value, mask);
+      }
+      backend_->SetForceStores(false);
+    }
+  }
+
+  // Clock in a column: write all the bits of "value" mentioned in "mask" with
+  // "clock" low, then raise "clock". The data is guaranteed to be on the
+  // pins before the rising edge. "clock" has to be part of "mask".
+  // Equivalent to WriteMaskedBits(value & ~clock, mask); SetBits(clock);
+  // but lets the implementation merge writes to the same register.
+  inline void WriteMaskedBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                      gpio_bits_t clock) {
+    if (slowdown_ == 0) {
+      backend_->WriteMaskedBitsAndClock(value, mask, clock);
+      return;
+    }
+    backend_->WriteMaskedBits(value & ~clock, mask);
+    backend_->SetForceStores(true);
+    for (int i = 1; i < slowdown_; ++i) {
+      backend_->WriteMaskedBits(value & ~clock, mask);
+    }
+    backend_->WriteMaskedBitsAndClock(value, mask, clock);
+    for (int i = 0; i < slowdown_; ++i) {
+      backend_->SetBits(clock);
+    }
+    backend_->SetForceStores(false);
   }
 
-  inline gpio_bits_t Read() const { return ReadRegisters() & input_bits_; }
+  // Keep color data in the native layout of the backend. See
+  // GPIOBackend::UseNativeColorLayout(); needs SetHardwareMapping() first.
+  bool UseNativeColorLayout(gpio_bits_t colors) {
+    return backend_ != NULL && backend_->UseNativeColorLayout(colors);
+  }
+  gpio_bits_t NativeBits(gpio_bits_t bits) const {
+    return backend_->NativeBits(bits);
+  }
 
-private:
-  gpio_bits_t ReadRegisters() const;
-  void WriteSetBits(gpio_bits_t value);
+  // Like WriteMaskedBitsAndClock(), but "value" and "mask" are in the native
+  // layout; "mask" does not contain "clock".
+  inline void WriteNativeBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                      gpio_bits_t clock) {
+    if (slowdown_ == 0) {
+      backend_->WriteNativeBitsAndClock(value, mask, clock);
+      return;
+    }
+    backend_->ClearBits(clock);
+    backend_->WriteNativeBits(value, mask);
+    backend_->SetForceStores(true);
+    for (int i = 1; i < slowdown_; ++i) {
+      backend_->ClearBits(clock);
+      backend_->WriteNativeBits(value, mask);
+    }
+    backend_->WriteNativeBitsAndClock(value, mask, clock);
+    for (int i = 0; i < slowdown_; ++i) {
+      backend_->SetBits(clock);
+    }
+    backend_->SetForceStores(false);
+  }
 
-  void WriteClrBits(gpio_bits_t value);
+  inline gpio_bits_t Read() const { return backend_->Read() & input_bits_; }
 
-private:
+  // The backend chosen in Init(); NULL before.
+  GPIOBackend *backend() const { return backend_; }
 
+private:
   gpio_bits_t output_bits_;
   gpio_bits_t input_bits_;
   gpio_bits_t reserved_bits_;
   int slowdown_;
 
-  volatile uint32_t *gpio_set_bits_low_;
-  volatile uint32_t *gpio_clr_bits_low_;
-  volatile uint32_t *gpio_read_bits_low_;
-
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-  bool uses_64_bit_;
-  volatile uint32_t *gpio_set_bits_high_;
-  volatile uint32_t *gpio_clr_bits_high_;
-  volatile uint32_t *gpio_read_bits_high_;
-#endif
+  // Never deleted: pin pulsers and the refresh thread hold on to it until
+  // the very end of the process.
+  GPIOBackend *backend_;
 };
 
 // A PinPulser is a utility class that pulses a GPIO pin. There can be various
@@ -124,6 +205,10 @@ public:
 
   // If SendPulse() is asynchronously implemented, wait for pulse to finish.
   virtual void WaitPulseFinished() {}
+
+  // If the asynchronous pulse is ended in software: end it if it is due.
+  // Called regularly while the next data is clocked in.
+  virtual void PollPulse() {}
 };
 
 // Get rolling over microsecond counter. We get this from a hardware register
@@ -13,40 +13,13 @@
 #include <unistd.h>
 
 #include "gpio.h"
+#include "gpio-backend.h"
+#include "hardware-mapping.h"
+#include "register-map.h"
+#include "rockchip-mapping.h"
+#include "rockchip-timing.h"
 
-/*
- * nanosleep() takes longer than requested because of OS jitter.
- * In about 99.9% of the cases, this is <= 25 microcseconds on
- * the Raspberry Pi (empirically determined with a Raspbian kernel), so
- * we substract this value whenever we do nanosleep(); the remaining time
- * we then busy wait to get a good accurate result.
- *
- * You can measure the overhead using DEBUG_SLEEP_JITTER below.
- *
- * Note: A higher value here will result in more CPU use because of more busy
- * waiting inching towards the real value (for all the cases that nanosleep()
- * actually was better than this overhead).
- *
- * This might be interesting to tweak in particular if you have a realtime
- * kernel with different characteristics.
- */
-#define EMPIRICAL_NANOSLEEP_OVERHEAD_US 12
-
-/*
- * In case of non-hardware pulse generation, use nanosleep if we want to wait
- * longer than these given microseconds beyond the general overhead.
- * Below that, just use busy wait.
- */
-#define MINIMUM_NANOSLEEP_TIME_US 5
-
-/* In order to determine useful values for above, set this to 1 and use the
- * hardware pin-pulser.
- * It will output a histogram atexit() of how much how often we were over
- * the requested time.
- * (The full histogram will be shifted by the EMPIRICAL_NANOSLEEP_OVERHEAD_US
- *  value above. To get a full histogram of OS overhead, set it to 0 first).
- */
-#define DEBUG_SLEEP_JITTER 0
+#include <vector>
 
 // Raspberry 1 and 2 have different base addresses for the periphery
 #define BCM2708_PERI_BASE        0x20000000
@@ -103,8 +76,6 @@
 #define GPIO_SET *(gpio+7)  // sets   bits which are 1 ignores bits which are 0
 #define GPIO_CLR *(gpio+10) // clears bits which are 1 ignores bits which are 0
 
-static volatile uint32_t *s_Timer1Mhz = NULL;
-
 #ifndef GPIO_BIT
 #define GPIO_BIT(b) (1ull<<(b))
 #endif
@@ -120,15 +91,28 @@ static volatile uint32_t *s_Timer1Mhz = NULL;
 #define REGISTER_BLOCK_SIZE (4*1024)
 #endif
 
+// Register offsets within a Rockchip GPIO bank.
+#define ROCKCHIP_GPIO_SWPORTA_DR   0x00   // Output data
+#define ROCKCHIP_GPIO_SWPORTA_DDR  0x04   // Data direction
+#define ROCKCHIP_GPIO_EXT_PORTA    0x50   // Pin levels, for reading inputs
+
 struct RockchipGPIO {
     char const *name;
     uint32_t base_address;
-    volatile uint32_t* base_read_reg, *base_write_reg;
-    volatile uint32_t* data_read_reg, *data_write_reg;
-    volatile uint32_t* direction_read_reg, *direction_write_reg;
-    volatile bool change;
-    volatile bool clear;
-    volatile uint32_t buffer;
+    rgb_matrix::RegisterBlock registers;
+    // Authoritative copy of the data register. Writes only ever store this
+    // value, so we never have to read back over the device bus.
+    uint32_t shadow;
+
+    volatile uint32_t *data_reg() const {
+        return registers.reg(ROCKCHIP_GPIO_SWPORTA_DR);
+    }
+    volatile uint32_t *direction_reg() const {
+        return registers.reg(ROCKCHIP_GPIO_SWPORTA_DDR);
+    }
+    volatile uint32_t *input_reg() const {
+        return registers.reg(ROCKCHIP_GPIO_EXT_PORTA);
+    }
 };
 
 static struct RockchipGPIO s_rk3288_gpios[] = {
@@ -137,90 +121,45 @@ static struct RockchipGPIO s_rk3288_gpios[] = {
 
         .base_address = 0xFF750000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
-   
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
     },
     {
         .name = "gpio1",
 
         .base_address = 0xFF780000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
-
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
     },
     {
         .name = "gpio2",
 
         .base_address = 0xFF790000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
-
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
-
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
     },
     {
         .name = "gpio3",
 
         .base_address = 0xFF7A0000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
-
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
     },
     {
         .name = "gpio4",
 
         .base_address = 0xFF7B0000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
-
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
 
     },
     {
@@ -228,18 +167,9 @@ static struct RockchipGPIO s_rk3288_gpios[] = {
 
         .base_address = 0xFF7C0000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
-
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
 
     },
     {
@@ -247,18 +177,9 @@ static struct RockchipGPIO s_rk3288_gpios[] = {
 
         .base_address = 0xFF7D0000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
-
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
 
     },
     {
@@ -266,18 +187,9 @@ static struct RockchipGPIO s_rk3288_gpios[] = {
 
         .base_address = 0xFF7E0000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
-
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
 
     },
     {
@@ -285,207 +197,57 @@ static struct RockchipGPIO s_rk3288_gpios[] = {
 
         .base_address = 0xFF7F0000,
 
-        .base_read_reg = NULL,
-        .base_write_reg = NULL,
-
-        .data_read_reg = NULL,
-        .data_write_reg = NULL,
-
-        .direction_read_reg = NULL,
-        .direction_write_reg = NULL,
+        .registers = rgb_matrix::RegisterBlock(),
 
-        .change = false,
-        .clear = false,
-        .buffer = 0,
+        .shadow = 0,
 
     }
 };
 
+#define ROCKCHIP_GPIO_BANKS (sizeof(s_rk3288_gpios) / sizeof(s_rk3288_gpios[0]))
+
 struct RPIMappingRockchip_GPIO {
-    uint32_t rpi_mask;
+    gpio_bits_t rpi_mask;
     uint32_t rockchip_mask;
     struct RockchipGPIO* rockchipGpio;
 };
 
+// The mapping in use: all connected signals of the HardwareMapping and its
+// RockchipPinMapping.
 struct RPIMappingRockchip {
     const char *name;
-    struct RPIMappingRockchip_GPIO output_enable;
-    struct RPIMappingRockchip_GPIO clock;
-    struct RPIMappingRockchip_GPIO strobe;
-
-    struct RPIMappingRockchip_GPIO a, b, c, d, e;
-    
-    struct RPIMappingRockchip_GPIO p0_r1, p0_g1, p0_b1, p0_r2, p0_g2, p0_b2;
-};
-
-static struct RPIMappingRockchip s_rpiRegularMappingRK3288 = {
-    .name = "regular",
-
-    .output_enable = 
-    {
-        .rpi_mask = GPIO_BIT(18),
-        .rockchip_mask = GPIO_BIT(4),
-        .rockchipGpio = &s_rk3288_gpios[8],
-    },
-    .clock = 
-    {   
-        .rpi_mask = GPIO_BIT(17),
-        .rockchip_mask = GPIO_BIT(6),
-        .rockchipGpio = &s_rk3288_gpios[8],
-    },
-    .strobe =            
-    {
-        .rpi_mask = GPIO_BIT(4),
-        .rockchip_mask = GPIO_BIT(5),
-        .rockchipGpio = &s_rk3288_gpios[8],
-    },
-
-    .a =            
-    {
-        .rpi_mask = GPIO_BIT(22),
-        .rockchip_mask = GPIO_BIT(8),
-        .rockchipGpio = &s_rk3288_gpios[5],
-    },
-    .b =            
-    {
-        .rpi_mask = GPIO_BIT(23),
-        .rockchip_mask = GPIO_BIT(9),
-        .rockchipGpio = &s_rk3288_gpios[5],
-    },
-    .c =            // TBD
-    {
-        .rpi_mask = GPIO_BIT(24),
-        .rockchip_mask = GPIO_BIT(7),
-        .rockchipGpio = &s_rk3288_gpios[8],
-    },
-    .d =            // Not determine
-    {
-        .rpi_mask = GPIO_BIT(25),
-        .rockchip_mask = GPIO_BIT(8),
-        .rockchipGpio = &s_rk3288_gpios[8],
-    },
-    .e =            // Not determine
-    {
-        .rpi_mask = GPIO_BIT(15),
-        .rockchip_mask = GPIO_BIT(9),
-        .rockchipGpio = &s_rk3288_gpios[8],
-    },
-
-    .p0_r1 =           
-    {
-        .rpi_mask = GPIO_BIT(11),
-        .rockchip_mask = GPIO_BIT(6),
-        .rockchipGpio = &s_rk3288_gpios[7],
-    },
-    .p0_g1 =           
-    {
-        .rpi_mask = GPIO_BIT(27),
-        .rockchip_mask = GPIO_BIT(5),
-        .rockchipGpio = &s_rk3288_gpios[7],
-    },
-    .p0_b1 =            
-    {
-        .rpi_mask = GPIO_BIT(7),
-        .rockchip_mask = GPIO_BIT(18),
-        .rockchipGpio = &s_rk3288_gpios[7],
-    },
-    .p0_r2 =           
-    {
-        .rpi_mask = GPIO_BIT(8),
-        .rockchip_mask = GPIO_BIT(17),
-        .rockchipGpio = &s_rk3288_gpios[7],
-    },
-    .p0_g2 =            
-    {
-        .rpi_mask = GPIO_BIT(9),
-        .rockchip_mask = GPIO_BIT(2),
-        .rockchipGpio = &s_rk3288_gpios[7],
-    },
-    .p0_b2 =            
-    {
-        .rpi_mask = GPIO_BIT(10),
-        .rockchip_mask = GPIO_BIT(0),
-        .rockchipGpio = &s_rk3288_gpios[7],
-    },
+    std::vector<struct RPIMappingRockchip_GPIO> signals;
 };
 
-static struct RPIMappingRockchip* s_rpiMappingRockchip = NULL;
-
-static volatile uint32_t* s_clock_base_read_reg = NULL;
-static volatile uint32_t* s_clock_base_write_reg = NULL;
+static struct RPIMappingRockchip s_rpiMappingRockchip;
 
-static volatile uint32_t* s_gpio_clock_control_read_reg = NULL; 
-static volatile uint32_t* s_gpio_clock_control_write_reg = NULL; 
-
-static uint32_t *mmap_register(off_t base, bool memread = true) {
-
-  int mem_fd;
-  if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-    perror("open /dev/mem");
-    return NULL;
-  }
-  uint32_t real_addr = base &~4095;
-  uint32_t offset = base - real_addr;
-  uint32_t length = 4 + offset;
-  length = (length+4095) & ~4095;
-  
-
-  uint32_t *result =
-    (uint32_t*) mmap64(NULL,                  // Any adddress in our space will do
-                     //REGISTER_BLOCK_SIZE,   // Map length
-                     length,
-                     memread?PROT_READ:PROT_WRITE,  // Enable r/w on GPIO registers.
-                     MAP_SHARED,
-                     mem_fd,                // File to map
-                     //base + register_offset // Offset to bcm register
-                     real_addr // Offset to bcm register
-                     );
-  close(mem_fd);
-
-  //if (result == MAP_FAILED) {
-  if (result == (void *)(-1)) {
-    fprintf(stderr, "MMapping failed\n");
-    perror("mmap error: ");
-    fprintf(stderr, "MMapping from base 0x%lx, real_addr 0x%lx, length 0x%lx\n",
-            base, (unsigned long)real_addr, (unsigned long)length);
-    return NULL;
-  }
-  return result;
-}
+static rgb_matrix::RegisterBlock s_clock_registers;
 
 static bool init_rockchip_gpio(struct RockchipGPIO *rockchipGpio)
 {
     if (rockchipGpio == NULL)
         return false;
 
-    rockchipGpio->base_read_reg = mmap_register(rockchipGpio->base_address);
-    rockchipGpio->base_write_reg = mmap_register(rockchipGpio->base_address, false);
-    if (rockchipGpio->base_read_reg == NULL || rockchipGpio->base_write_reg == NULL)
+    if (!rockchipGpio->registers.Map(rockchipGpio->base_address))
         return false;
-    
-    rockchipGpio->data_read_reg = rockchipGpio->base_read_reg;
-    rockchipGpio->data_write_reg = rockchipGpio->base_write_reg;
-     
-    rockchipGpio->direction_read_reg = rockchipGpio->base_read_reg + (4 / sizeof(uint32_t));        
-    rockchipGpio->direction_write_reg = rockchipGpio->base_write_reg + (4 / sizeof(uint32_t));
+
+    // The only time we read the data register: afterwards, the shadow is
+    // what is in the register, as we're the only ones writing to it.
+    rockchipGpio->shadow = *(rockchipGpio->data_reg());
     return true;
 }
 
 static bool mmap_all_register_once() {
-    if (s_clock_base_read_reg != NULL) 
-	return true;
-    
-    s_clock_base_read_reg = mmap_register(CLOCK_CON_BASE_ADDRESS); 
-    if (s_clock_base_read_reg == NULL)
-	return false;
-    s_clock_base_write_reg = mmap_register(CLOCK_CON_BASE_ADDRESS, false); 
-    if (s_clock_base_write_reg == NULL)
-	return false;
+    if (s_clock_registers.valid())
+        return true;
+
+    if (!s_clock_registers.Map(CLOCK_CON_BASE_ADDRESS))
+        return false;
 
-    s_gpio_clock_control_read_reg = s_clock_base_read_reg + (GPIO5_CLOCK_CON_OFFSET/sizeof(uint32_t));
-    s_gpio_clock_control_write_reg = s_clock_base_write_reg + (GPIO5_CLOCK_CON_OFFSET/sizeof(uint32_t));
+    // Ungate the GPIO clocks before we touch any of the banks.
+    *(s_clock_registers.reg(GPIO5_CLOCK_CON_OFFSET)) = 0xffff0000;
 
-    for (int idx = 0; idx <= 8; idx++) {
+    for (size_t idx = 0; idx < ROCKCHIP_GPIO_BANKS; idx++) {
         if(init_rockchip_gpio(&s_rk3288_gpios[idx]) == false)
             return false; 
     }
@@ -493,545 +255,451 @@ static bool mmap_all_register_once() {
     return true;
 }
 
-static bool init_rpi_mapping_rk3288_once()
+static bool build_rockchip_mapping(const struct HardwareMapping &h,
+                                   const struct RockchipPinMapping &pins,
+                                   struct RPIMappingRockchip *mapping)
 {
-    if (s_rpiMappingRockchip != NULL)
-        return true;
+    mapping->name = h.name;
+    mapping->signals.clear();
+    for (int s = 0; s < rgb_matrix::kRockchipSignalCount; ++s) {
+        const rgb_matrix::RockchipSignal &signal = rgb_matrix::kRockchipSignals[s];
+        const rockchip_pin_t pin = pins.*signal.pin;
+        const gpio_bits_t bits = h.*signal.bits;
+        if (!ROCKCHIP_PIN_IS_CONNECTED(pin) || bits == 0)
+            continue;
+        if (ROCKCHIP_PIN_BANK(pin) >= ROCKCHIP_GPIO_BANKS) {
+            fprintf(stderr, "Rockchip mapping '%s': %s is on GPIO%d, but "
+                    "there are only %d banks.\n", pins.name, signal.name,
+                    ROCKCHIP_PIN_BANK(pin), (int)ROCKCHIP_GPIO_BANKS);
+            return false;
+        }
+        struct RPIMappingRockchip_GPIO gpio;
+        gpio.rpi_mask = bits;
+        gpio.rockchip_mask = 1u << ROCKCHIP_PIN_BIT(pin);
+        gpio.rockchipGpio = &s_rk3288_gpios[ROCKCHIP_PIN_BANK(pin)];
+        mapping->signals.push_back(gpio);
+    }
+    return true;
+}
+
+/*
+ * Translating the Raspberry Pi style gpio_bits_t into Rockchip banks is in the
+ * innermost loop of Framebuffer::DumpToMatrix(), so we don't want to test every
+ * mapped signal there. Instead, the mapping is compiled at GPIO::Init() time
+ * into per-byte lookup tables: every byte of a gpio_bits_t value indexes a
+ * table that contains the resulting words for each of the banks in use.
+ * Translating a value is then a handful of lookups and ORs.
+ *
+ * Banks are referred to by slot in s_output_banks[] to keep the tables small.
+ */
+#define ROCKCHIP_MAX_OUTPUT_BANKS 4
 
-    s_rpiMappingRockchip = &s_rpiRegularMappingRK3288;
+struct RockchipBankWords {
+    uint32_t bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+};
 
-    if (s_rpiMappingRockchip == NULL)
-        return false;
-    return mmap_all_register_once();
+static struct RockchipGPIO *s_output_banks[ROCKCHIP_MAX_OUTPUT_BANKS];
+static int s_output_bank_count = 0;
+static struct RockchipBankWords s_translate_lut[sizeof(gpio_bits_t)][256];
+
+static int find_output_bank_slot(const struct RockchipGPIO *rockchipGpio)
+{
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (s_output_banks[i] == rockchipGpio)
+            return i;
+    }
+    return -1;
 }
 
-static bool enableGPIOClock() 
+static int add_output_bank_slot(struct RockchipGPIO *rockchipGpio)
 {
-    if (s_clock_base_write_reg == NULL)
-        return false;
-    *(s_gpio_clock_control_write_reg) = 0xffff0000;
-    return true;
+    const int slot = find_output_bank_slot(rockchipGpio);
+    if (slot >= 0)
+        return slot;
+    if (s_output_bank_count == ROCKCHIP_MAX_OUTPUT_BANKS)
+        return -1;
+    s_output_banks[s_output_bank_count] = rockchipGpio;
+    return s_output_bank_count++;
 }
 
-static bool setGPIOMode(struct RPIMappingRockchip_GPIO* gpio, bool outputMode = true)
+static bool compile_translation_tables(struct RPIMappingRockchip *mapping)
 {
-    if (gpio == NULL || gpio-> rockchipGpio == NULL)
-        return false;
-    uint32_t direct = gpio->rockchip_mask;
-    outputMode?
-    *(gpio-> rockchipGpio->direction_write_reg) |= direct:
-    *(gpio-> rockchipGpio->direction_write_reg) &= ~direct;
+    s_output_bank_count = 0;
+    memset(s_translate_lut, 0, sizeof(s_translate_lut));
+    for (size_t s = 0; s < mapping->signals.size(); ++s) {
+        const struct RPIMappingRockchip_GPIO &gpio = mapping->signals[s];
+        const int slot = add_output_bank_slot(gpio.rockchipGpio);
+        if (slot < 0) {
+            fprintf(stderr, "Rockchip mapping '%s' uses more than %d GPIO "
+                    "banks.\n", mapping->name, ROCKCHIP_MAX_OUTPUT_BANKS);
+            return false;
+        }
+        const gpio_bits_t rpi_mask = gpio.rpi_mask;
+        for (size_t byte = 0; byte < sizeof(gpio_bits_t); ++byte) {
+            const unsigned byte_mask = (rpi_mask >> (8 * byte)) & 0xff;
+            if (byte_mask == 0)
+                continue;
+            for (unsigned value = 0; value < 256; ++value) {
+                if (value & byte_mask)
+                    s_translate_lut[byte][value].bits[slot] |= gpio.rockchip_mask;
+            }
+        }
+    }
     return true;
 }
 
-static bool setGPIOsMode(uint32_t inputs, bool outputMode = true)
+// Translate Raspberry Pi style bits into per-bank words, indexed by slot.
+static inline void translateGPIOs(gpio_bits_t inputs, uint32_t *bank_bits)
 {
-    if (s_rpiMappingRockchip == NULL)
-        return false;
-
-    if(!enableGPIOClock())
-        return false;
-    //fprintf(stdout, " setGPIOsMode, inputs= 0x%lx\n", inputs);
-
-    // Only care about GPIO mapping to rockchip
-    if ( (s_rpiMappingRockchip->output_enable.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->output_enable), outputMode);
-
-    if ( (s_rpiMappingRockchip->clock.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->clock), outputMode);   
-
-    if ( (s_rpiMappingRockchip->strobe.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->strobe), outputMode); 
-
-
-    if ( (s_rpiMappingRockchip->a.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->a), outputMode);
-
-    if ( (s_rpiMappingRockchip->b.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->b), outputMode);
-
-    if ( (s_rpiMappingRockchip->c.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->c), outputMode);
-
-    if ( (s_rpiMappingRockchip->d.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->d), outputMode);
-
-    if ( (s_rpiMappingRockchip->e.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->e), outputMode);
-
-    if ( (s_rpiMappingRockchip->p0_r1.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->p0_r1), outputMode);
+    for (int i = 0; i < ROCKCHIP_MAX_OUTPUT_BANKS; ++i)
+        bank_bits[i] = 0;
+    for (int byte = 0; inputs != 0; ++byte, inputs >>= 8) {
+        const struct RockchipBankWords &words = s_translate_lut[byte][inputs & 0xff];
+        for (int i = 0; i < ROCKCHIP_MAX_OUTPUT_BANKS; ++i)
+            bank_bits[i] |= words.bits[i];
+    }
+}
 
-    if ( (s_rpiMappingRockchip->p0_g1.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->p0_g1), outputMode);
+// Set the direction of all pins for "inputs". The direction register of
+// each bank is written once, no matter how many signals (e.g. parallel
+// chains) live on it. Returns the bits that actually have a pin.
+static gpio_bits_t setGPIOsMode(gpio_bits_t inputs, bool outputMode = true)
+{
+    if (s_rpiMappingRockchip.name == NULL)
+        return 0;
 
-    if ( (s_rpiMappingRockchip->p0_b1.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->p0_b1), outputMode);
+    gpio_bits_t mapped = 0;
+    for (size_t s = 0; s < s_rpiMappingRockchip.signals.size(); ++s)
+        mapped |= s_rpiMappingRockchip.signals[s].rpi_mask;
+    inputs &= mapped;
+
+    uint32_t bank_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    translateGPIOs(inputs, bank_bits);
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (bank_bits[i] == 0)
+            continue;
+        volatile uint32_t *direction = s_output_banks[i]->direction_reg();
+        outputMode?
+        *direction |= bank_bits[i]:
+        *direction &= ~bank_bits[i];
+    }
+    return inputs;
+}
 
-    if ( (s_rpiMappingRockchip->p0_r2.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->p0_r2), outputMode);
+// Set while writes are repeated to hold the pins longer; see
+// GPIOBackend::SetForceStores().
+static bool s_force_stores = false;
 
-    if ( (s_rpiMappingRockchip->p0_g2.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->p0_g2), outputMode);
+// Store new content of a bank. This is a single plain store, and only if the
+// value actually changes or stores are forced.
+static inline void storeGPIOBank(struct RockchipGPIO *rockchipGpio, uint32_t value)
+{
+    if (value == rockchipGpio->shadow && !s_force_stores)
+        return;
+    rockchipGpio->shadow = value;
+    *(rockchipGpio->data_reg()) = value;
+}
 
-    if ( (s_rpiMappingRockchip->p0_b2.rpi_mask & inputs) > 0)
-        setGPIOMode(&(s_rpiMappingRockchip->p0_b2), outputMode);
+static bool setGPIOs(gpio_bits_t inputs, bool clear_bit = false)
+{
+    uint32_t bank_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    translateGPIOs(inputs, bank_bits);
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (bank_bits[i] == 0)
+            continue;
+        struct RockchipGPIO *rockchipGpio = s_output_banks[i];
+        storeGPIOBank(rockchipGpio, clear_bit
+                      ? rockchipGpio->shadow & ~bank_bits[i]
+                      : rockchipGpio->shadow | bank_bits[i]);
+    }
     return true;
 }
 
-static inline void flashGPIOs()
+// Set all bits in "mask" to the corresponding bit in "value", with exactly one
+// store per bank that changes.
+static void writeGPIOs(gpio_bits_t value, gpio_bits_t mask)
 {
-    for(int i = 5; i <=8; i++) {
-        if (s_rk3288_gpios[i].change){
-            !s_rk3288_gpios[i].clear?
-             *(s_rk3288_gpios[i].data_write_reg) |= s_rk3288_gpios[i].buffer:
-             *(s_rk3288_gpios[i].data_write_reg) &= (s_rk3288_gpios[i].buffer);
-             s_rk3288_gpios[i].change = false;
-             s_rk3288_gpios[i].clear = false;
-           
-        }
+    uint32_t value_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    uint32_t mask_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    translateGPIOs(value & mask, value_bits);
+    translateGPIOs(mask, mask_bits);
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (mask_bits[i] == 0)
+            continue;
+        struct RockchipGPIO *rockchipGpio = s_output_banks[i];
+        storeGPIOBank(rockchipGpio,
+                      (rockchipGpio->shadow & ~mask_bits[i]) | value_bits[i]);
     }
 }
 
-
-static bool setGPIODirect(struct RPIMappingRockchip_GPIO* gpio, bool clear_bit = false)
+// Translations of the mask and clock of the last writeGPIOsAndClock(); they
+// stay the same for all columns of a row.
+static gpio_bits_t s_clocked_mask = 0;
+static gpio_bits_t s_clocked_clock = 0;
+static uint32_t s_clocked_mask_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+static uint32_t s_clocked_clock_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+
+// Write "value" in "mask" with "clock" low, then raise "clock".
+// Every bank is computed once: banks without the clock get a single store
+// and are written first, so data is stable before the edge. The bank with the
+// clock gets its data together with the falling edge, then the rising edge.
+static void writeGPIOsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                               gpio_bits_t clock)
 {
-    if (gpio == NULL || gpio-> rockchipGpio == NULL)
-        return false;
-    uint32_t data = gpio->rockchip_mask;
-
-    !clear_bit?
-    *(gpio-> rockchipGpio->data_write_reg) |= data:
-    *(gpio-> rockchipGpio->data_write_reg) &= ~data;
-    return true;
+    if (mask != s_clocked_mask || clock != s_clocked_clock) {
+        translateGPIOs(mask | clock, s_clocked_mask_bits);
+        translateGPIOs(clock, s_clocked_clock_bits);
+        s_clocked_mask = mask;
+        s_clocked_clock = clock;
+    }
+    uint32_t value_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    translateGPIOs(value & mask & ~clock, value_bits);
+
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (s_clocked_mask_bits[i] == 0 || s_clocked_clock_bits[i] != 0)
+            continue;
+        struct RockchipGPIO *rockchipGpio = s_output_banks[i];
+        storeGPIOBank(rockchipGpio, (rockchipGpio->shadow & ~s_clocked_mask_bits[i])
+                      | value_bits[i]);
+    }
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (s_clocked_clock_bits[i] == 0)
+            continue;
+        struct RockchipGPIO *rockchipGpio = s_output_banks[i];
+        storeGPIOBank(rockchipGpio, (rockchipGpio->shadow & ~s_clocked_mask_bits[i])
+                      | value_bits[i]);
+        storeGPIOBank(rockchipGpio, rockchipGpio->shadow | s_clocked_clock_bits[i]);
+    }
 }
 
-static inline bool setGPIO(struct RPIMappingRockchip_GPIO* gpio, bool clear_bit = false)
-{
-    if (gpio == NULL || gpio-> rockchipGpio == NULL)
-        return false;
-    uint32_t data = gpio->rockchip_mask;
-/*    if (!gpio->rockchipGpio->change) 
-        gpio->rockchipGpio->buffer = *(gpio->rockchipGpio->data_read_reg);
-  */ 
-    !clear_bit?
-    gpio-> rockchipGpio->buffer |= data:
-    gpio-> rockchipGpio->buffer &= ~data;
-    
-    gpio->rockchipGpio->change = true;
-    gpio->rockchipGpio->clear = clear_bit;
-
-/*    !clear_bit?
-    *(gpio-> rockchipGpio->data_write_reg) |= data:
-    *(gpio-> rockchipGpio->data_write_reg) &= ~data;
-*/
-
-    /*uint32_t result = 0;
-    result = *(gpio-> rockchipGpio->data_read_reg);
-    bool cmp_result = !clear_bit? result & data: ~result & data;
-    if (!cmp_result) {
-        fprintf(stderr, "setGPIO failed, data=0x%lx, result=0x%lx, clear_bit=%s\n", 
-                data, result,clear_bit?"true":"false");
-    }*/
+// Native layout: color data is kept as the content of the data register of
+// a single bank, so clocking in a column needs no translation.
+static struct RockchipGPIO *s_native_bank = NULL;
+static gpio_bits_t s_native_clock = 0;
+static struct RockchipGPIO *s_native_clock_bank = NULL;
+static uint32_t s_native_clock_bit = 0;
 
-    return true;
+static bool useNativeColorLayout(gpio_bits_t colors)
+{
+    uint32_t bank_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    translateGPIOs(colors, bank_bits);
+    s_native_bank = NULL;
+    for (int i = 0; i < s_output_bank_count; ++i) {
+        if (bank_bits[i] == 0)
+            continue;
+        if (s_native_bank != NULL) {
+            s_native_bank = NULL;  // Colors on more than one bank.
+            return false;
+        }
+        s_native_bank = s_output_banks[i];
+    }
+    s_native_clock = 0;
+    return s_native_bank != NULL;
 }
 
-static inline uint32_t readGPIO(struct RPIMappingRockchip_GPIO* gpio)
+static uint32_t nativeBits(gpio_bits_t bits)
 {
-    if (gpio == NULL || gpio-> rockchipGpio == NULL)
-        return false;
-    uint32_t data = *(gpio->rockchipGpio->data_read_reg);
-    return data & gpio->rockchip_mask;
+    uint32_t bank_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+    translateGPIOs(bits, bank_bits);
+    const int slot = find_output_bank_slot(s_native_bank);
+    return slot >= 0 ? bank_bits[slot] : 0;
 }
 
-static uint32_t readGPIOs(uint32_t inputs);
+static inline void writeNativeGPIOs(uint32_t value, uint32_t mask)
+{
+    storeGPIOBank(s_native_bank, (s_native_bank->shadow & ~mask) | value);
+}
 
-static uint32_t last_gpios_status = 0xffffffff;
-static bool last_clear_bit = false;
+// Same sequence as writeGPIOsAndClock(), but the data is already translated.
+static void writeNativeGPIOsAndClock(uint32_t value, uint32_t mask,
+                                     gpio_bits_t clock)
+{
+    if (clock != s_native_clock) {
+        uint32_t bank_bits[ROCKCHIP_MAX_OUTPUT_BANKS];
+        translateGPIOs(clock, bank_bits);
+        s_native_clock_bank = NULL;
+        s_native_clock_bit = 0;
+        for (int i = 0; i < s_output_bank_count; ++i) {
+            if (bank_bits[i] != 0) {
+                s_native_clock_bank = s_output_banks[i];
+                s_native_clock_bit = bank_bits[i];
+            }
+        }
+        s_native_clock = clock;
+    }
+    struct RockchipGPIO *data = s_native_bank;
+    struct RockchipGPIO *clk = s_native_clock_bank;
+    if (clk == data) {
+        const uint32_t low = (data->shadow & ~(mask | s_native_clock_bit)) | value;
+        storeGPIOBank(data, low);
+        storeGPIOBank(data, low | s_native_clock_bit);
+    } else {
+        storeGPIOBank(data, (data->shadow & ~mask) | value);
+        if (clk != NULL) {
+            storeGPIOBank(clk, clk->shadow & ~s_native_clock_bit);
+            storeGPIOBank(clk, clk->shadow | s_native_clock_bit);
+        }
+    }
+}
 
-static bool setGPIOs(uint32_t inputs, bool clear_bit = false)
+static gpio_bits_t readGPIOs(gpio_bits_t inputs)
 {
-    if(last_gpios_status == inputs && last_clear_bit == clear_bit)
-        return true;
-    last_gpios_status = inputs;
-    last_clear_bit = clear_bit;
+    gpio_bits_t result = 0;
+    if (s_rpiMappingRockchip.name == NULL)
+        return 0;
 
-    if (s_rpiMappingRockchip == NULL)
-        return false;
+    // Read each bank only once, then pick the signals out of it. The data
+    // register only holds what we output, so read the actual pin levels.
+    uint32_t bank_data[ROCKCHIP_MAX_OUTPUT_BANKS];
+    for (int i = 0; i < s_output_bank_count; ++i)
+        bank_data[i] = *(s_output_banks[i]->input_reg());
+
+    for (size_t s = 0; s < s_rpiMappingRockchip.signals.size(); ++s) {
+        const struct RPIMappingRockchip_GPIO &gpio = s_rpiMappingRockchip.signals[s];
+        if ((gpio.rpi_mask & inputs) == 0)
+            continue;
+        const int slot = find_output_bank_slot(gpio.rockchipGpio);
+        if (slot >= 0 && (bank_data[slot] & gpio.rockchip_mask) > 0)
+            result |= gpio.rpi_mask;
+    }
+    return result;
+}
 
-    if(!enableGPIOClock())
+// Use the Rockchip pins of "h": those of its spec, or the compiled-in ones of
+// the same name.
+static bool set_rockchip_mapping(const struct HardwareMapping &h)
+{
+    if (s_rpiMappingRockchip.name != NULL
+        && strcmp(s_rpiMappingRockchip.name, h.name) == 0)
+        return true;  // Already in use; keep the native layout as well.
+
+    const struct RockchipPinMapping *pins = rgb_matrix::FindRockchipPinMapping(h);
+    if (pins == NULL) {
+        fprintf(stderr, "There are no Rockchip pins for the '%s' GPIO mapping. "
+                "Available: ", h.name);
+        for (struct RockchipPinMapping *it = rockchip_pin_mappings; it->name; ++it) {
+            if (it != rockchip_pin_mappings) fprintf(stderr, ", ");
+            fprintf(stderr, "'%s'", it->name);
+        }
+        fprintf(stderr, "; or give a mapping spec with --led-gpio-mapping\n");
         return false;
-
-    //fprintf(stdout, " setGPIOs, inputs= 0x%lx, clear data=%d\n", inputs, clear_bit);
-    /*switch(inputs){
-        case GPIO_BIT(18):
-            setGPIODirect(&(s_rpiMappingRockchip->output_enable), clear_bit);
-            return true;
-	    break;
-        case GPIO_BIT(17):
-            setGPIODirect(&(s_rpiMappingRockchip->clock), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(4):
-            setGPIODirect(&(s_rpiMappingRockchip->strobe), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(22):
-            setGPIODirect(&(s_rpiMappingRockchip->a), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(23):
-            setGPIODirect(&(s_rpiMappingRockchip->b), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(24):
-            setGPIODirect(&(s_rpiMappingRockchip->c), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(25):
-            setGPIODirect(&(s_rpiMappingRockchip->d), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(15):
-            setGPIODirect(&(s_rpiMappingRockchip->e), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(11):
-            setGPIODirect(&(s_rpiMappingRockchip->p0_r1), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(27):
-            setGPIODirect(&(s_rpiMappingRockchip->p0_g1), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(7):
-            setGPIODirect(&(s_rpiMappingRockchip->p0_b1), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(8):
-            setGPIODirect(&(s_rpiMappingRockchip->p0_r2), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(9):
-            setGPIODirect(&(s_rpiMappingRockchip->p0_g2), clear_bit);
-            return true;
-            break;
-        case GPIO_BIT(10):
-            setGPIODirect(&(s_rpiMappingRockchip->p0_b2), clear_bit);
-            return true;
-            break;
-       case 0x8020f80:
-            setGPIO(&(s_rpiMappingRockchip->clock), clear_bit);
-            setGPIO(&(s_rpiMappingRockchip->p0_r1), clear_bit);
-            setGPIO(&(s_rpiMappingRockchip->p0_g1), clear_bit);
-            setGPIO(&(s_rpiMappingRockchip->p0_b1), clear_bit);
-            setGPIO(&(s_rpiMappingRockchip->p0_r2), clear_bit);
-            setGPIO(&(s_rpiMappingRockchip->p0_g2), clear_bit);
-            setGPIO(&(s_rpiMappingRockchip->p0_b2), clear_bit);
-            flashGPIOs();
-	    return true;
-	    break;
-
-    }//end switch
-*/
-    //fprintf(stdout, " setGPIOs, inputs= 0x%lx, clear data=%d\n", inputs, clear_bit);
-    // Only care about GPIO mapping to rockchip
-    if ( (s_rpiMappingRockchip->output_enable.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->output_enable), clear_bit);
-
-    if ( (s_rpiMappingRockchip->clock.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->clock), clear_bit);
-
-    if ( (s_rpiMappingRockchip->strobe.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->strobe), clear_bit);
-
-    
-    if ( (s_rpiMappingRockchip->a.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->a), clear_bit);
-
-    if ( (s_rpiMappingRockchip->b.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->b), clear_bit);
-
-    if ( (s_rpiMappingRockchip->c.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->c), clear_bit);
-
-    if ( (s_rpiMappingRockchip->d.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->d), clear_bit);
-
-    if ( (s_rpiMappingRockchip->e.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->e), clear_bit);
-
-    if ( (s_rpiMappingRockchip->p0_r1.rpi_mask & inputs) > 0){
-        setGPIO(&(s_rpiMappingRockchip->p0_r1), clear_bit);
     }
 
-    if ( (s_rpiMappingRockchip->p0_g1.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->p0_g1), clear_bit);
-
-    if ( (s_rpiMappingRockchip->p0_b1.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->p0_b1), clear_bit);
-
-    if ( (s_rpiMappingRockchip->p0_r2.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->p0_r2), clear_bit);
-
-    if ( (s_rpiMappingRockchip->p0_g2.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->p0_g2), clear_bit);
-
-    if ( (s_rpiMappingRockchip->p0_b2.rpi_mask & inputs) > 0)
-        setGPIO(&(s_rpiMappingRockchip->p0_b2), clear_bit);
- 
-    flashGPIOs();   
-    //fprintf(stdout, " data  after set= 0x%lx\n", readGPIOs(inputs));
-
+    struct RPIMappingRockchip mapping;
+    if (!build_rockchip_mapping(h, *pins, &mapping))
+        return false;
+    if (!compile_translation_tables(&mapping))
+        return false;
+    s_rpiMappingRockchip = mapping;
+    s_clocked_mask = s_clocked_clock = 0;  // Force re-translation.
+    s_native_bank = NULL;
     return true;
 }
 
-static uint32_t readGPIOs(uint32_t inputs)
+// Until told otherwise, assume the regular mapping.
+static bool init_rpi_mapping_rk3288_once()
 {
-    uint32_t result = 0;
-    if (s_rpiMappingRockchip == NULL)
-        return 0;
-
-    if (!enableGPIOClock())
-        return 0;
-
-    //fprintf(stdout, " readGPIOs, inputs= 0x%lx\n", inputs);
-    // Only care about GPIO mapping to rockchip
-    if ( (s_rpiMappingRockchip->output_enable.rpi_mask & inputs) > 0)
-        if (readGPIO(&(s_rpiMappingRockchip->output_enable)) > 0)
-            result |= s_rpiMappingRockchip->output_enable.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->clock.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->clock)) > 0)
-            result |= s_rpiMappingRockchip->clock.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->strobe.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->strobe)) > 0)
-            result |= s_rpiMappingRockchip->strobe.rpi_mask;
-
-
-    if ( (s_rpiMappingRockchip->a.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->a)) > 0)
-            result |= s_rpiMappingRockchip->a.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->b.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->b)) >0)
-            result |= s_rpiMappingRockchip->b.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->c.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->c)) > 0)
-            result |= s_rpiMappingRockchip->c.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->d.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->d)) > 0)
-            result |= s_rpiMappingRockchip->d.rpi_mask;
-
-
-    if ( (s_rpiMappingRockchip->e.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->e)) > 0)
-            result |= s_rpiMappingRockchip->e.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->p0_r1.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->p0_r1)) > 0)
-            result |= s_rpiMappingRockchip->p0_r1.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->p0_g1.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->p0_g1)) > 0)
-            result |= s_rpiMappingRockchip->p0_g1.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->p0_b1.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->p0_b1)) > 0)
-            result |= s_rpiMappingRockchip->p0_b1.rpi_mask;
-
-    if ( (s_rpiMappingRockchip->p0_r2.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->p0_r2)) > 0)
-            result |= s_rpiMappingRockchip->p0_r2.rpi_mask;
+    if (!mmap_all_register_once())
+        return false;
 
-    if ( (s_rpiMappingRockchip->p0_g2.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->p0_g2)) > 0)
-            result |= s_rpiMappingRockchip->p0_g2.rpi_mask;
+    if (s_rpiMappingRockchip.name != NULL)
+        return true;
 
-    if ( (s_rpiMappingRockchip->p0_b2.rpi_mask & inputs) > 0)
-        if(readGPIO(&(s_rpiMappingRockchip->p0_b2)) > 0)
-            result |= s_rpiMappingRockchip->p0_b2.rpi_mask;
-    return result;;
+    for (struct HardwareMapping *it = matrix_hardware_mappings; it->name; ++it) {
+        if (strcmp(it->name, "regular") == 0)
+            return set_rockchip_mapping(*it);
+    }
+    return false;
 }
 
 namespace rgb_matrix {
 
-GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
-               slowdown_(1)
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-             , uses_64_bit_(false)
-#endif
-{
-}
+#define CLEAR_DATA true
 
+// The Rockchip GPIO. Bits come as defined by the HardwareMapping and are
+// translated to the pins of its RockchipPinMapping.
+class RockchipGPIOBackend : public GPIOBackend {
+public:
+  virtual const char *name() const { return "rk3288"; }
 
-gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
-                              bool adafruit_pwm_transition_hack_needed) {
-  if (s_rpiMappingRockchip == NULL) {
-    fprintf(stderr, "Attempt to init outputs but not yet Init()-ialized.\n");
-    return 0;
+  virtual bool Init() {
+    if (!init_rpi_mapping_rk3288_once())
+      return false;
+    RockchipTiming::Init();
+    return true;
   }
 
-  outputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-  const int kMaxAvailableBit = 45;
-  uses_64_bit_ |= (outputs >> 32) != 0;
-#else
-  const int kMaxAvailableBit = 31;
-#endif
-  setGPIOsMode(outputs); // set outputs Mode: output
-  output_bits_ |= outputs;
-  return outputs;
-}// end GPIO::InitOutputs
-
-gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
-  if (s_rpiMappingRockchip == NULL) {
-    fprintf(stderr, "Attempt to init inputs but not yet Init()-ialized.\n");
-    return 0;
+  virtual uint32_t GetMicrosecondCounter() {
+    return RockchipTiming::MicrosecondCounter();
   }
 
-  inputs &= ~(output_bits_ | input_bits_ | reserved_bits_);
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-  const int kMaxAvailableBit = 45;
-  uses_64_bit_ |= (inputs >> 32) != 0;
-#else
-  const int kMaxAvailableBit = 31;
-#endif
-  setGPIOsMode(inputs, false); // set inputs Mode: input;
-  input_bits_ |= inputs;
-  return inputs;
-}// end GPIO::RequestInputs
-
-// We are not interested in the _exact_ model, just good enough to determine
-// What to do.
-enum RaspberryPiModel {
-  PI_MODEL_1,
-  PI_MODEL_2,
-  PI_MODEL_3,
-  PI_MODEL_4
-};
+  virtual bool SetHardwareMapping(const struct HardwareMapping &mapping) {
+    return set_rockchip_mapping(mapping);
+  }
 
-static int ReadFileToBuffer(char *buffer, size_t size, const char *filename) {
-  const int fd = open(filename, O_RDONLY);
-  if (fd < 0) return -1;
-  ssize_t r = read(fd, buffer, size - 1); // assume one read enough
-  buffer[r >= 0 ? r : 0] = '\0';
-  close(fd);
-  return r;
-}
+  virtual gpio_bits_t ConfigureOutputs(gpio_bits_t outputs) {
+    return setGPIOsMode(outputs); // set outputs Mode: output
+  }
 
-static RaspberryPiModel DetermineRaspberryModel() {
-  char buffer[4096];
-  if (ReadFileToBuffer(buffer, sizeof(buffer), "/proc/cpuinfo") < 0) {
-    fprintf(stderr, "Reading cpuinfo: Could not determine Pi model, Return PI_MODEL_3\n");
-    return PI_MODEL_3;  // safe guess fallback.
+  virtual gpio_bits_t ConfigureInputs(gpio_bits_t inputs) {
+    return setGPIOsMode(inputs, false); // set inputs Mode: input;
   }
-  static const char RevisionTag[] = "Revision";
-  const char *revision_key;
-  if ((revision_key = strstr(buffer, RevisionTag)) == NULL) {
-    fprintf(stderr, "non-existent Revision: Could not determine Pi model, Return PI_MODEL_3\n");
-    return PI_MODEL_3;
+
+  virtual void SetBits(gpio_bits_t value) {
+    setGPIOs(value, !CLEAR_DATA);
   }
-  unsigned int pi_revision = 0;
-  /*if (sscanf(index(revision_key, ':') + 1, "%x", &pi_revision) != 1) {
-    fprintf(stderr, "Unknown Revision: Could not determine Pi model\n");
-    return PI_MODEL_3;
-  }*/
-
-  // https://www.raspberrypi.org/documentation/hardware/raspberrypi/revision-codes/README.md
-  const unsigned pi_type = (pi_revision >> 4) & 0xff;
-  switch (pi_type) {
-  case 0x00: /* A */
-  case 0x01: /* B, Compute Module 1 */
-  case 0x02: /* A+ */
-  case 0x03: /* B+ */
-  case 0x05: /* Alpha ?*/
-  case 0x06: /* Compute Module1 */
-  case 0x09: /* Zero */
-  case 0x0c: /* Zero W */
-    return PI_MODEL_1;
-
-  case 0x04:  /* Pi 2 */
-    return PI_MODEL_2;
-
-  case 0x11: /* Pi 4 */
-  case 0x14: /* CM4 */
-    return PI_MODEL_4;
-
-  default:  /* a bunch of versions representing Pi 3 */
-    return PI_MODEL_3;
+
+  virtual void ClearBits(gpio_bits_t value) {
+    setGPIOs(value, CLEAR_DATA);
   }
-}
 
-static RaspberryPiModel GetPiModel() {
-  static RaspberryPiModel pi_model = DetermineRaspberryModel();
-  pi_model = PI_MODEL_1;
-  fprintf(stdout, "GetPiModel= %d\n", pi_model);
-  return pi_model;
-}
+  virtual void WriteMaskedBits(gpio_bits_t value, gpio_bits_t mask) {
+    writeGPIOs(value, mask);
+  }
 
-static int GetNumCores() {
-  return GetPiModel() == PI_MODEL_1 ? 1 : 4;
-}
+  virtual void WriteMaskedBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) {
+    writeGPIOsAndClock(value, mask, clock);
+  }
 
-bool GPIO::Init(int slowdown) {
-  slowdown_ = slowdown;
+  virtual gpio_bits_t Read() const {
+    return readGPIOs(~(gpio_bits_t)0);
+  }
 
-  // Pre-mmap all bcm registers we need now and possibly in the future, as to
-  // allow  dropping privileges after GPIO::Init() even as some of these
-  // registers might be needed later.
-  if (!init_rpi_mapping_rk3288_once())
-    return false;
+  virtual void SetForceStores(bool force) {
+    s_force_stores = force;
+  }
 
-  return true;
-}//end GPIO::Init
+  virtual bool UseNativeColorLayout(gpio_bits_t colors) {
+    return useNativeColorLayout(colors);
+  }
 
-#define CLEAR_DATA true
+  virtual gpio_bits_t NativeBits(gpio_bits_t bits) const {
+    return nativeBits(bits);
+  }
 
-gpio_bits_t GPIO::ReadRegisters() const {
-    uint32_t data = readGPIOs(0xffffffff);
-    return (static_cast<gpio_bits_t>(data)
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-            | (static_cast<gpio_bits_t>(data) << 32)
-#endif
-            );
-  }// end GPIO::ReadRegisters
-
-void GPIO::WriteSetBits(gpio_bits_t value) {
-    setGPIOs(static_cast<uint32_t>(value & 0xFFFFFFFF), !CLEAR_DATA);
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-    if (uses_64_bit_)
-      setGPIOS(static_cast<uint32_t>(value >> 32), !CLEAR_DATA);
-#endif
-  }// end GPIO::WriteSetBits
+  virtual void WriteNativeBits(gpio_bits_t value, gpio_bits_t mask) {
+    writeNativeGPIOs(value, mask);
+  }
 
-void GPIO::WriteClrBits(gpio_bits_t value) {
-    setGPIOs(static_cast<uint32_t>(value & 0xFFFFFFFF), CLEAR_DATA);
-#ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-    if (uses_64_bit_)
-      setGPIOs(static_cast<uint32_t>(value >> 32), CLEAR_DATA);
-#endif
-  }// end GPIO::WriteClrBits
+  virtual void WriteNativeBitsAndClock(gpio_bits_t value, gpio_bits_t mask,
+                                       gpio_bits_t clock) {
+    writeNativeGPIOsAndClock(value, mask, clock);
+  }
+
+  virtual PinPulser *CreatePinPulser(GPIO *io, gpio_bits_t gpio_mask,
+                                     bool allow_hardware_pulsing,
+                                     const std::vector<int> &nano_wait_spec);
+};
 
 /*
  * We support also other pinouts that don't have the OE- on the hardware
  * PWM output pin, so we need to provide (impefect) 'manual' timing as well.
- * Hence all various busy_wait_nano() implementations depending on the hardware.
+ * The clock and busy wait for that are in rockchip-timing.cc
  */
 
 // --- PinPulser. Private implementation parts.
 namespace {
-// Manual timers.
-class Timers {
-public:
-  static bool Init();
-  static void sleep_nanos(long t);
-};
-
 // Simplest of PinPulsers. Uses somewhat jittery and manual timers
 // to get the timing, but not optimal.
 class TimerBasedPinPulser : public PinPulser {
@@ -1039,16 +707,11 @@ public:
   TimerBasedPinPulser(GPIO *io, gpio_bits_t bits,
                       const std::vector<int> &nano_specs)
     : io_(io), bits_(bits), nano_specs_(nano_specs) {
-    if (!s_Timer1Mhz) {
-      fprintf(stderr, "FYI: not running as root which means we can't properly "
-              "control timing unless this is a real-time kernel. Expect color "
-              "degradation. Consider running as root with sudo.\n");
-    }
   }
 
   virtual void SendPulse(int time_spec_number) {
     io_->ClearBits(bits_);
-    Timers::sleep_nanos(nano_specs_[time_spec_number]);
+    RockchipTiming::SleepNanos(nano_specs_[time_spec_number]);
     io_->SetBits(bits_);
   }
 
@@ -1058,27 +721,74 @@ private:
   const std::vector<int> nano_specs_;
 };
 
-static bool LinuxHasModuleLoaded(const char *name) {
-  FILE *f = fopen("/proc/modules", "r");
-  if (f == NULL) return false; // don't care.
-  char buf[256];
-  const size_t namelen = strlen(name);
-  bool found = false;
-  while (fgets(buf, sizeof(buf), f) != NULL) {
-    if (strncmp(buf, name, namelen) == 0) {
-      found = true;
-      break;
+// There is no PWM on the OE pins of the Rockchip mappings, so this does in
+// software what the HardwarePinPulser of the Pi does: SendPulse() switches
+// the output on and returns, so the next data can be clocked in meanwhile.
+// The pulse is ended at its deadline in PollPulse() or WaitPulseFinished().
+//
+// PollPulse() is called in roughly constant intervals. If the deadline is
+// closer than the next call, it waits for it right away, so the pulse ends
+// on time. Pulses shorter than that interval are done synchronously.
+class DeadlinePinPulser : public PinPulser {
+public:
+  DeadlinePinPulser(GPIO *io, gpio_bits_t bits,
+                    const std::vector<int> &nano_specs)
+    : io_(io), bits_(bits), nano_specs_(nano_specs),
+      poll_interval_(0), last_interval_long_(false), last_poll_(0),
+      deadline_(0), triggered_(false) {
+    for (size_t i = 0; i < nano_specs.size(); ++i) {
+      tick_specs_.push_back(RockchipTiming::NanosToTicks(nano_specs[i]));
     }
   }
-  fclose(f);
-  return found;
-}
 
-static void busy_wait_nanos_rpi_1(long nanos);
-static void busy_wait_nanos_rpi_2(long nanos);
-static void busy_wait_nanos_rpi_3(long nanos);
-static void busy_wait_nanos_rpi_4(long nanos);
-static void (*busy_wait_impl)(long) = busy_wait_nanos_rpi_3;
+  virtual void SendPulse(int time_spec_number) {
+    io_->ClearBits(bits_);
+    if (tick_specs_[time_spec_number] <= poll_interval_) {
+      RockchipTiming::SleepNanos(nano_specs_[time_spec_number]);
+      io_->SetBits(bits_);
+      return;
+    }
+    last_poll_ = RockchipTiming::Ticks();
+    deadline_ = last_poll_ + tick_specs_[time_spec_number];
+    triggered_ = true;
+  }
+
+  virtual void PollPulse() {
+    if (!triggered_) return;
+    const uint64_t now = RockchipTiming::Ticks();
+    // Clocking in takes about the same time every time; a single much longer
+    // interval means the operating system interrupted us. Don't learn from
+    // that, only if it happens again.
+    const uint64_t interval = now - last_poll_;
+    const bool long_interval = (interval > 2 * poll_interval_);
+    if (!long_interval || last_interval_long_ || poll_interval_ == 0) {
+      poll_interval_ = interval;
+    }
+    last_interval_long_ = long_interval;
+    last_poll_ = now;
+    if (deadline_ <= now + poll_interval_) {
+      WaitPulseFinished();
+    }
+  }
+
+  virtual void WaitPulseFinished() {
+    if (!triggered_) return;
+    RockchipTiming::SleepUntil(deadline_);
+    io_->SetBits(bits_);
+    triggered_ = false;
+  }
+
+private:
+  GPIO *const io_;
+  const gpio_bits_t bits_;
+  const std::vector<int> nano_specs_;
+  std::vector<uint64_t> tick_specs_;
+  uint64_t poll_interval_;   // Ticks between two polls.
+  bool last_interval_long_;
+  uint64_t last_poll_;
+  uint64_t deadline_;
+  bool triggered_;
+};
 
 // Best effort write to file. Used to set kernel parameters.
 static void WriteTo(const char *filename, const char *str) {
@@ -1094,160 +804,39 @@ static void WriteTo(const char *filename, const char *str) {
 // our RT-thread is locked onto one of these.
 // So let's tell it not to do that.
 static void DisableRealtimeThrottling() {
-  if (GetNumCores() == 1) return;   // Not safe if we don't have > 1 core.
+  // Not safe if we don't have > 1 core.
+  if (sysconf(_SC_NPROCESSORS_ONLN) <= 1) return;
   // We need to leave the kernel a little bit of time, as it does not like
   // us to hog the kernel solidly. The default of 950000 leaves 50ms that
   // can generate visible flicker, so we reduce that to 1ms.
   WriteTo("/proc/sys/kernel/sched_rt_runtime_us", "999000");
 }
+} // end anonymous namespace
 
-bool Timers::Init() {
+PinPulser *RockchipGPIOBackend::CreatePinPulser(
+  GPIO *io, gpio_bits_t gpio_mask, bool allow_hardware_pulsing,
+  const std::vector<int> &nano_wait_spec) {
   if (!init_rpi_mapping_rk3288_once())
-    return false;
-
-  fprintf(stdout, "Timers::Init");
-  // Choose the busy-wait loop that fits our Pi.
-  switch (GetPiModel()) {
-  case PI_MODEL_1: busy_wait_impl = busy_wait_nanos_rpi_1; break;
-  case PI_MODEL_2: busy_wait_impl = busy_wait_nanos_rpi_2; break;
-  case PI_MODEL_3: busy_wait_impl = busy_wait_nanos_rpi_3; break;
-  case PI_MODEL_4: busy_wait_impl = busy_wait_nanos_rpi_4; break;
-  }
+    return NULL;
 
   DisableRealtimeThrottling();
   // If we have it, we run the update thread on core3. No perf-compromises:
   WriteTo("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor",
           "performance");
-  return true;
-}
-
-static uint32_t JitterAllowanceMicroseconds() {
-  // If this is a Raspberry Pi with more than one core, we add a bit of
-  // additional overhead measured up to the 99.999%-ile: we can allow to burn
-  // a bit more busy-wait CPU cycles to get the timing accurate as we have
-  // more CPU to spare.
-  switch (GetPiModel()) {
-  case PI_MODEL_1:
-    return EMPIRICAL_NANOSLEEP_OVERHEAD_US;  // 99.9%-ile
-  case PI_MODEL_2: case PI_MODEL_3:
-    return EMPIRICAL_NANOSLEEP_OVERHEAD_US + 35;  // 99.999%-ile
-  case PI_MODEL_4:
-    return EMPIRICAL_NANOSLEEP_OVERHEAD_US + 10;  // this one is fast.
-  }
-  return EMPIRICAL_NANOSLEEP_OVERHEAD_US;
-}
-
-void Timers::sleep_nanos(long nanos) {
-  // For smaller durations, we go straight to busy wait.
-
-  // For larger duration, we use nanosleep() to give the operating system
-  // a chance to do something else.
-
-  // However, these timings have a lot of jitter, so if we have the 1Mhz timer
-  // available, we use that to accurately mesure time spent and do the
-  // remaining time with busy wait. If we don't have the timer available
-  // (not running as root), we just use nanosleep() for larger values.
-
-  if (s_Timer1Mhz) {
-    static long kJitterAllowanceNanos = JitterAllowanceMicroseconds() * 1000;
-    if (nanos > kJitterAllowanceNanos + MINIMUM_NANOSLEEP_TIME_US*1000) {
-      const uint32_t before = *s_Timer1Mhz;
-      struct timespec sleep_time = { 0, nanos - kJitterAllowanceNanos };
-      nanosleep(&sleep_time, NULL);
-      const uint32_t after = *s_Timer1Mhz;
-      const long nanoseconds_passed = 1000 * (uint32_t)(after - before);
-      if (nanoseconds_passed > nanos) {
-        return;  // darn, missed it.
-      } else {
-        nanos -= nanoseconds_passed; // remaining time with busy-loop
-      }
-    }
-  } else {
-    // Not running as root, not having access to 1Mhz timer. Approximate large
-    // durations with nanosleep(); small durations are done with busy wait.
-    if (nanos > (EMPIRICAL_NANOSLEEP_OVERHEAD_US + MINIMUM_NANOSLEEP_TIME_US)*1000) {
-      struct timespec sleep_time
-        = { 0, nanos - EMPIRICAL_NANOSLEEP_OVERHEAD_US*1000 };
-      nanosleep(&sleep_time, NULL);
-      return;
-    }
+  // The busy wait is calibrated again at the new CPU speed.
+  RockchipTiming::Init();
+  if (!RockchipTiming::has_hardware_clock()) {
+    fprintf(stderr, "FYI: no hardware timer available, which means we "
+            "can't properly control timing unless this is a real-time "
+            "kernel. Expect color degradation.\n");
   }
-
-  busy_wait_impl(nanos);  // Use model-specific busy-loop for remaining time.
-}
-
-static void busy_wait_nanos_rpi_1(long nanos) {
-  if (nanos < 70) return;
-  // The following loop is determined empirically on a 700Mhz RPi
-  for (uint32_t i = (nanos - 70) >> 2; i != 0; --i) {
-    asm("nop");
-  }
-}
-
-static void busy_wait_nanos_rpi_2(long nanos) {
-  if (nanos < 20) return;
-  // The following loop is determined empirically on a 900Mhz RPi 2
-  for (uint32_t i = (nanos - 20) * 100 / 110; i != 0; --i) {
-    asm("");
-  }
-}
-
-static void busy_wait_nanos_rpi_3(long nanos) {
-  if (nanos < 20) return;
-  for (uint32_t i = (nanos - 15) * 100 / 73; i != 0; --i) {
-    asm("");
-  }
-}
-
-static void busy_wait_nanos_rpi_4(long nanos) {
-  if (nanos < 20) return;
-  // Interesting, the Pi4 is _slower_ than the Pi3 ? At least for this busy loop
-  for (uint32_t i = (nanos - 5) * 100 / 132; i != 0; --i) {
-    asm("");
-  }
-
-}
-
-#if DEBUG_SLEEP_JITTER
-static int overshoot_histogram_us[256] = {0};
-static void print_overshoot_histogram() {
-  fprintf(stderr, "Overshoot histogram >= empirical overhead of %dus\n"
-          "%6s | %7s | %7s\n",
-          JitterAllowanceMicroseconds(), "usec", "count", "accum");
-  int total_count = 0;
-  for (int i = 0; i < 256; ++i) total_count += overshoot_histogram_us[i];
-  int running_count = 0;
-  for (int us = 0; us < 256; ++us) {
-    const int count = overshoot_histogram_us[us];
-    if (count > 0) {
-      running_count += count;
-      fprintf(stderr, "%s%3dus: %8d %7.3f%%\n", (us == 0) ? "<=" : " +",
-              us, count, 100.0 * running_count / total_count);
-    }
-  }
-}
-#endif
-} // end anonymous namespace
-
-// Public PinPulser factory
-PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
-                             bool allow_hardware_pulsing,
-                             const std::vector<int> &nano_wait_spec) {
-  if (!Timers::Init()) return NULL;
-  return new TimerBasedPinPulser(io, gpio_mask, nano_wait_spec);
-  
+  if (allow_hardware_pulsing)
+    return new DeadlinePinPulser(io, gpio_mask, nano_wait_spec);
+  else
+    return new TimerBasedPinPulser(io, gpio_mask, nano_wait_spec);
 }
 
-// For external use, e.g. in the matrix for extra time.
-uint32_t GetMicrosecondCounter() {
-  if (s_Timer1Mhz) return *s_Timer1Mhz;
-
-  // When run as non-root, we can't read the timer. Fall back to slow
-  // operating-system ways.
-  struct timespec ts;
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  const uint64_t micros = ts.tv_nsec / 1000;
-  const uint64_t epoch_usec = (uint64_t)ts.tv_sec * 1000000 + micros;
-  return epoch_usec & 0xFFFFFFFF;
+GPIOBackend *CreateRockchipGPIOBackend() {
+  return new RockchipGPIOBackend();
 }
 }// end namespace rgb_matrix
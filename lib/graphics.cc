@@ -48,32 +48,10 @@ bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
   const int w = std::min(c->width(), canvas_offset_x + image_display_w);
   const int h = std::min(c->height(), canvas_offset_y + image_display_h);
 
-  // Bytes to skip for wider than canvas image at the end of a row
-  const size_t skip_end_row = (canvas_offset_x + image_display_w > w)
-    ? (canvas_offset_x + image_display_w - w) * 3
-    : 0;
-
-  // Let's make this a combined skip per row and ajust where we start.
-  const size_t next_row_skip = skip_start_row + skip_end_row;
   buffer += skip_start_row;
-
-  if (is_bgr) {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[2], buffer[1], buffer[0]);
-        buffer += 3;
-      }
-      buffer += next_row_skip;
-    }
-  } else {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[0], buffer[1], buffer[2]);
-        buffer += 3;
-      }
-      buffer += next_row_skip;
-    }
-  }
+  c->SetPixels(canvas_offset_x, canvas_offset_y,
+               w - canvas_offset_x, h - canvas_offset_y,
+               buffer, 3 * width, is_bgr);
   return true;
 }
 
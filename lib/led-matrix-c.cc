@@ -81,10 +81,12 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     OPT_COPY_IF_SET(disable_hardware_pulsing);
     OPT_COPY_IF_SET(show_refresh_rate);
     OPT_COPY_IF_SET(inverse_colors);
+    OPT_COPY_IF_SET(skip_reclock);
     OPT_COPY_IF_SET(led_rgb_sequence);
     OPT_COPY_IF_SET(pixel_mapper_config);
     OPT_COPY_IF_SET(panel_type);
     OPT_COPY_IF_SET(limit_refresh_rate_hz);
+    OPT_COPY_IF_SET(pixel_mapping_cache);
 #undef OPT_COPY_IF_SET
   }
 
@@ -95,6 +97,7 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     RT_OPT_COPY_IF_SET(daemon);
     RT_OPT_COPY_IF_SET(drop_privileges);
     RT_OPT_COPY_IF_SET(do_gpio_init);
+    RT_OPT_COPY_IF_SET(gpio_backend);
 #undef RT_OPT_COPY_IF_SET
   }
 
@@ -125,10 +128,12 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_OPT(disable_hardware_pulsing);
     ACTUAL_VALUE_BACK_TO_OPT(show_refresh_rate);
     ACTUAL_VALUE_BACK_TO_OPT(inverse_colors);
+    ACTUAL_VALUE_BACK_TO_OPT(skip_reclock);
     ACTUAL_VALUE_BACK_TO_OPT(led_rgb_sequence);
     ACTUAL_VALUE_BACK_TO_OPT(pixel_mapper_config);
     ACTUAL_VALUE_BACK_TO_OPT(panel_type);
     ACTUAL_VALUE_BACK_TO_OPT(limit_refresh_rate_hz);
+    ACTUAL_VALUE_BACK_TO_OPT(pixel_mapping_cache);
 #undef ACTUAL_VALUE_BACK_TO_OPT
   }
 
@@ -138,6 +143,7 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_RT_OPT(daemon);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_privileges);
     ACTUAL_VALUE_BACK_TO_RT_OPT(do_gpio_init);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(gpio_backend);
 #undef ACTUAL_VALUE_BACK_TO_RT_OPT
   }
 
@@ -198,6 +204,11 @@ struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
   return from_canvas(to_matrix(matrix)->SwapOnVSync(to_canvas(canvas)));
 }
 
+struct LedCanvas *led_matrix_try_swap(struct RGBLedMatrix *matrix,
+                                      struct LedCanvas *canvas) {
+  return from_canvas(to_matrix(matrix)->TrySwap(to_canvas(canvas)));
+}
+
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix,
                                uint8_t brightness) {
   to_matrix(matrix)->SetBrightness(brightness);
@@ -207,6 +218,20 @@ uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix) {
   return to_matrix(matrix)->brightness();
 }
 
+void led_matrix_set_refresh_brightness(struct RGBLedMatrix *matrix,
+                                       uint8_t brightness) {
+  to_matrix(matrix)->SetRefreshBrightness(brightness);
+}
+
+uint8_t led_matrix_get_refresh_brightness(struct RGBLedMatrix *matrix) {
+  return to_matrix(matrix)->refresh_brightness();
+}
+
+bool led_matrix_set_pixel_mappers(struct RGBLedMatrix *matrix,
+                                  const char *pixel_mapper_config) {
+  return to_matrix(matrix)->SetPixelMappers(pixel_mapper_config);
+}
+
 void led_canvas_get_size(const struct LedCanvas *canvas,
                          int *width, int *height) {
   rgb_matrix::FrameCanvas *c = to_canvas((struct LedCanvas*)canvas);
@@ -16,10 +16,12 @@
 #include "led-matrix.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <grp.h>
 #include <pwd.h>
 #include <math.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,6 +31,8 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <atomic>
+
 #include "gpio.h"
 #include "thread.h"
 #include "framebuffer-internal.h"
@@ -55,14 +59,15 @@ public:
   // Needs an initialized GPIO object and configuration options from the
   // RGBMatrix::Options struct.
   //
-  // If you pass an GPIO object (which has to be Init()ialized), it will start  // the internal thread to start the screen immediately.
+  // If you pass an GPIO object (which has to be Init()ialized), it will start  // the internal thread to start the screen immediately, unless
+  // "start_thread" is false; then call StartRefresh() later.
   //
   // If you need finer control over when the refresh thread starts (which you
   // might when you become a daemon), pass NULL here and see SetGPIO() method.
   //
   // The resulting canvas is (options.rows * options.parallel) high and
   // (32 * options.chain_length) wide.
-  Impl(GPIO *io, const Options &options);
+  Impl(GPIO *io, const Options &options, bool start_thread = true);
 
   ~Impl();
 
@@ -74,7 +79,9 @@ public:
 
   FrameCanvas *CreateFrameCanvas();
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
+  FrameCanvas *TrySwap(FrameCanvas *other, unsigned framerate_fraction);
   bool ApplyPixelMapper(const PixelMapper *mapper);
+  bool SetPixelMappers(const char *pixel_mapper_config);
 
   bool SetPWMBits(uint8_t value);
   uint8_t pwmbits();   // return the pwm-bits of the currently active buffer.
@@ -98,11 +105,28 @@ private:
   friend class RGBMatrix;
 
   // Apply pixel mappers that have been passed down via a configuration
-  // string.
-  void ApplyNamedPixelMappers(const char *pixel_mapper_config,
-                              int chain, int parallel);
+  // string to "map", replacing it. Returns false if any of them could not be
+  // applied; the others still are.
+  static bool ApplyNamedPixelMappers(const char *pixel_mapper_config,
+                                     int chain, int parallel,
+                                     internal::PixelDesignatorMap **map);
+  // Returns "mapper" applied to "map" as a new map, or NULL if the mapper
+  // can't map it.
+  static internal::PixelDesignatorMap *MapPixels(
+    const internal::PixelDesignatorMap &map, const PixelMapper *mapper);
+
+  // Start using the map of the last SetPixelMappers(), if any.
+  void UsePendingPixelMapper();
+
+  // Options::pixel_mapping_cache holds the panel_pixel_mapper_ and the
+  // shared_pixel_mapper_ of a previous start along with this key, which
+  // describes what went into them.
+  std::string PixelMappingCacheKey() const;
+  bool ReadPixelMappingCache(const std::string &key);
+  void WritePixelMappingCache(const std::string &key) const;
 
   Options params_;
+  const int bitplanes_;  // pwm_bits we were created with; see Framebuffer.
   bool do_luminance_correct_;
 
   FrameCanvas *active_;
@@ -110,14 +134,31 @@ private:
   GPIO *io_;
   Mutex active_frame_sync_;
   UpdateThread *updater_;
+  bool has_spare_frame_;  // Whether TrySwap() added the third frame yet.
   std::vector<FrameCanvas*> created_frames_;
   internal::PixelDesignatorMap *shared_pixel_mapper_;
+  // The map of the panels, before any of the pixel mappers from the options.
+  // SetPixelMappers() starts from this one.
+  internal::PixelDesignatorMap *panel_pixel_mapper_;
+  Mutex set_pixel_mappers_sync_;  // One SetPixelMappers() at a time.
+  Mutex pending_pixel_mapper_sync_;
+  internal::PixelDesignatorMap *pending_pixel_mapper_;
+  // The map replaced by the last swap. Other threads might still be drawing
+  // with it, so it is only deleted with the swap after.
+  internal::PixelDesignatorMap *retired_pixel_mapper_;
   uint64_t user_output_bits_;
 };
 
 using namespace internal;
 
 // Pump pixels to screen. Needs to be high priority real-time because jitter
+//
+// Frames are triple buffered: besides the one shown and the one the user
+// draws into, there is the ready frame, which the refresh thread and the
+// user exchange theirs with. So neither ever waits for a lock held by the
+// other; SwapOnVSync() and AwaitInputChange() wait on semaphores, which the
+// refresh thread posts without blocking. There is only one thread swapping
+// frames at a time.
 class RGBMatrix::Impl::UpdateThread : public Thread {
 public:
   UpdateThread(GPIO *io, FrameCanvas *initial_frame,
@@ -125,11 +166,11 @@ public:
                int limit_refresh_hz)
     : io_(io), show_refresh_(show_refresh),
       target_frame_usec_(limit_refresh_hz < 1 ? 0 : 1e6/limit_refresh_hz),
-      running_(true),
-      current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
-    pthread_cond_init(&frame_done_, NULL);
-    pthread_cond_init(&input_change_, NULL);
+      running_(true), gpio_inputs_(0), input_waiting_(false),
+      current_frame_(initial_frame), ready_frame_(0),
+      requested_frame_multiple_(1), frame_waiting_(false) {
+    sem_init(&frame_done_, 0, 0);
+    sem_init(&input_change_, 0, 0);
     switch (pwm_dither_bits) {
     case 0:
       start_bit_[0] = 0; start_bit_[1] = 0;
@@ -146,8 +187,13 @@ public:
     }
   }
 
+  virtual ~UpdateThread() {
+    WaitStopped();
+    sem_destroy(&frame_done_);
+    sem_destroy(&input_change_);
+  }
+
   void Stop() {
-    MutexLock l(&running_mutex_);
     running_ = false;
   }
 
@@ -166,23 +212,28 @@ public:
     while (running()) {
       const uint32_t start_time_us = GetMicrosecondCounter();
 
-      current_frame_->framebuffer()
+      const int saved_clockouts = current_frame_->framebuffer()
         ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4]);
 
       // SwapOnVSync() exchange.
-      {
-        MutexLock l(&frame_sync_);
-        // Do fast equality test first (likely due to frame_count reset).
-        if (frame_count == requested_frame_multiple_
-            || frame_count % requested_frame_multiple_ == 0) {
-          // We reset to avoid frame hick-up every couple of weeks
-          // run-time iff requested_frame_multiple_ is not a factor of 2^32.
-          frame_count = 0;
-          if (next_frame_ != NULL) {
-            current_frame_ = next_frame_;
-            next_frame_ = NULL;
-          }
-          pthread_cond_signal(&frame_done_);
+      const unsigned frame_multiple = requested_frame_multiple_;
+      // Do fast equality test first (likely due to frame_count reset).
+      if (frame_count == frame_multiple
+          || frame_count % frame_multiple == 0) {
+        // We reset to avoid frame hick-up every couple of weeks
+        // run-time iff requested_frame_multiple_ is not a factor of 2^32.
+        frame_count = 0;
+        // Show the ready frame, if there is a new one, and leave ours.
+        uintptr_t ready = ready_frame_;
+        while ((ready & kNewFrame)
+               && !ready_frame_.compare_exchange_weak(
+                 ready, reinterpret_cast<uintptr_t>(current_frame_))) {
+        }
+        if (ready & kNewFrame) {
+          current_frame_ = reinterpret_cast<FrameCanvas*>(ready & ~kNewFrame);
+        }
+        if (frame_waiting_ && frame_waiting_.exchange(false)) {
+          sem_post(&frame_done_);
         }
       }
 
@@ -190,9 +241,10 @@ public:
       const gpio_bits_t inputs = io_->Read();
       if (inputs != last_gpio_bits) {
         last_gpio_bits = inputs;
-        MutexLock l(&input_sync_);
         gpio_inputs_ = inputs;
-        pthread_cond_signal(&input_change_);
+        if (input_waiting_.exchange(false)) {
+          sem_post(&input_change_);
+        }
       }
 
       ++frame_count;
@@ -207,7 +259,10 @@ public:
       const uint32_t end_time_us = GetMicrosecondCounter();
       if (show_refresh_) {
         uint32_t usec = end_time_us - start_time_us;
-        printf("\b\b\b\b\b\b\b\b%6.1fHz", 1e6 / usec);
+        // Also the number of bitplanes not clocked in, as they were already
+        // in the panels.
+        printf("\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b%6.1fHz%6d saved",
+               1e6 / usec, saved_clockouts);
         if (usec > largest_time && max_measure_enabled) {
           largest_time = usec;
           const float lowest_hz = 1e6 / largest_time;
@@ -221,24 +276,84 @@ public:
     }
   }
 
+  // Show "other" from the next VSync on and wait for that. Returns the frame
+  // shown before, or NULL if "other" is NULL; then this only waits.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned frame_fraction) {
-    MutexLock l(&frame_sync_);
-    FrameCanvas *previous = current_frame_;
-    next_frame_ = other;
     requested_frame_multiple_ = frame_fraction;
-    frame_sync_.WaitOn(&frame_done_);
-    return previous;
+    // Wait before publishing "other", so the VSync showing it can't miss us.
+    frame_waiting_ = true;
+    FrameCanvas *const spare = other ? MakeReady(other) : NULL;
+    for (;;) {
+      while (sem_wait(&frame_done_) != 0 && errno == EINTR) {
+      }
+      // A VSync before "other" was published does not count.
+      if (other == NULL || !(ready_frame_ & kNewFrame)) break;
+      frame_waiting_ = true;
+    }
+    if (other == NULL) return NULL;
+    // The refresh thread left the frame it showed before as the ready one.
+    // Take it; whatever was ready before stays there for TrySwap().
+    return reinterpret_cast<FrameCanvas*>(
+      ready_frame_.exchange(reinterpret_cast<uintptr_t>(spare)));
+  }
+
+  // Leave "spare" as the ready frame, so TrySwap() always has a frame to
+  // return. Only before the first TrySwap().
+  void AddSpareFrame(FrameCanvas *spare) {
+    uintptr_t none = 0;
+    const bool was_empty = ready_frame_.compare_exchange_strong(
+      none, reinterpret_cast<uintptr_t>(spare));
+    assert(was_empty);
+    (void) was_empty;
+  }
+
+  // Show "other" from the next VSync on, without waiting. Returns a frame
+  // that is not shown anymore.
+  FrameCanvas *TrySwap(FrameCanvas *other, unsigned frame_fraction) {
+    requested_frame_multiple_ = frame_fraction;
+    return MakeReady(other);
   }
 
   gpio_bits_t AwaitInputChange(int timeout_ms) {
-    MutexLock l(&input_sync_);
-    input_sync_.WaitOn(&input_change_, timeout_ms);
+    input_waiting_ = true;
+    if (timeout_ms < 0) {
+      while (sem_wait(&input_change_) != 0 && errno == EINTR) {
+      }
+      return gpio_inputs_;
+    }
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += timeout_ms / 1000;
+    t.tv_nsec += (timeout_ms % 1000) * 1000000;
+    t.tv_sec += t.tv_nsec / 1000000000;
+    t.tv_nsec %= 1000000000;
+    int result;
+    while ((result = sem_timedwait(&input_change_, &t)) != 0
+           && errno == EINTR) {
+    }
+    // If we timed out while the refresh thread saw us waiting, it posts
+    // right away. Take that, so the next call does not see it.
+    if (result != 0 && !input_waiting_.exchange(false)) {
+      while (sem_wait(&input_change_) != 0 && errno == EINTR) {
+      }
+    }
     return gpio_inputs_;
   }
 
 private:
+  // Set in ready_frame_ if the frame there is to be shown next, not one
+  // the refresh thread is done with.
+  static const uintptr_t kNewFrame = 1;
+
+  // Make "other" the ready frame; returns the previous one, which is not
+  // shown: either it never was, or the refresh thread is done with it.
+  FrameCanvas *MakeReady(FrameCanvas *other) {
+    const uintptr_t previous = ready_frame_.exchange(
+      reinterpret_cast<uintptr_t>(other) | kNewFrame);
+    return reinterpret_cast<FrameCanvas*>(previous & ~kNewFrame);
+  }
+
   inline bool running() {
-    MutexLock l(&running_mutex_);
     return running_;
   }
 
@@ -247,18 +362,17 @@ private:
   const uint32_t target_frame_usec_;
   uint32_t start_bit_[4];
 
-  Mutex running_mutex_;
-  bool running_;
+  std::atomic<bool> running_;
 
-  Mutex input_sync_;
-  pthread_cond_t input_change_;
-  gpio_bits_t gpio_inputs_;
+  std::atomic<gpio_bits_t> gpio_inputs_;
+  std::atomic<bool> input_waiting_;  // Post input_change_ on next change.
+  sem_t input_change_;
 
-  Mutex frame_sync_;
-  pthread_cond_t frame_done_;
-  FrameCanvas *current_frame_;
-  FrameCanvas *next_frame_;
-  unsigned requested_frame_multiple_;
+  FrameCanvas *current_frame_;  // Only used by the refresh thread.
+  std::atomic<uintptr_t> ready_frame_;  // FrameCanvas*, maybe | kNewFrame
+  std::atomic<unsigned> requested_frame_multiple_;
+  std::atomic<bool> frame_waiting_;  // Post frame_done_ on next VSync.
+  sem_t frame_done_;
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -310,14 +424,16 @@ RGBMatrix::Options::Options() :
 #else
     inverse_colors(false),
 #endif
+  skip_reclock(false),
   led_rgb_sequence("RGB"),
   pixel_mapper_config(NULL),
   panel_type(NULL),
 #ifdef FIXED_FRAME_MICROSECONDS
-  limit_refresh_rate_hz(1e6 / FIXED_FRAME_MICROSECONDS)
+  limit_refresh_rate_hz(1e6 / FIXED_FRAME_MICROSECONDS),
 #else
-  limit_refresh_rate_hz(0)
+  limit_refresh_rate_hz(0),
 #endif
+  pixel_mapping_cache(NULL)
 {
   // Nothing to see here.
 }
@@ -344,18 +460,24 @@ static void PrintOptions(const RGBMatrix::Options &o) {
   P_BOOL(disable_hardware_pulsing);
   P_BOOL(show_refresh_rate);
   P_BOOL(inverse_colors);
+  P_BOOL(skip_reclock);
   P_STR(led_rgb_sequence);
   P_STR(pixel_mapper_config);
   P_STR(panel_type);
   P_INT(limit_refresh_rate_hz);
+  P_STR(pixel_mapping_cache);
 #undef P_INT
 #undef P_STR
 #undef P_BOOL
 }
 #endif  // DEBUG_MATRIX_OPTIONS
 
-RGBMatrix::Impl::Impl(GPIO *io, const Options &options)
-  : params_(options), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL),
+RGBMatrix::Impl::Impl(GPIO *io, const Options &options, bool start_thread)
+  : params_(options), bitplanes_(options.pwm_bits),
+    io_(NULL), updater_(NULL), has_spare_frame_(false),
+    shared_pixel_mapper_(NULL),
+    panel_pixel_mapper_(NULL), pending_pixel_mapper_(NULL),
+    retired_pixel_mapper_(NULL),
     user_output_bits_(0) {
   assert(params_.Validate(NULL));
 #if DEBUG_MATRIX_OPTIONS
@@ -377,17 +499,87 @@ RGBMatrix::Impl::Impl(GPIO *io, const Options &options)
   }
 
   Framebuffer::InitHardwareMapping(params_.hardware_mapping);
+  if (io != NULL) {
+    // Before the first framebuffer is created: it determines the layout.
+    Framebuffer::InitNativeLayout(io, params_.parallel);
+  }
 
   active_ = CreateFrameCanvas();
   active_->Clear();
-  SetGPIO(io, true);
+  SetGPIO(io, start_thread);
+
+  const bool use_cache = (params_.pixel_mapping_cache != NULL
+                          && *params_.pixel_mapping_cache != '\0');
+  const std::string cache_key = use_cache ? PixelMappingCacheKey() : "";
+  if (use_cache && ReadPixelMappingCache(cache_key))
+    return;
 
   // We need to apply the mapping for the panels first.
   ApplyPixelMapper(multiplex_mapper);
+  panel_pixel_mapper_ = new PixelDesignatorMap(*shared_pixel_mapper_);
 
   // .. followed by higher level mappers that might arrange panels.
   ApplyNamedPixelMappers(options.pixel_mapper_config,
-                         params_.chain_length, params_.parallel);
+                         params_.chain_length, params_.parallel,
+                         &shared_pixel_mapper_);
+
+  if (use_cache) WritePixelMappingCache(cache_key);
+}
+
+std::string RGBMatrix::Impl::PixelMappingCacheKey() const {
+  // The map of the Framebuffer, before any mapping, stands in for all
+  // hardware details. What happens to it depends on the mappers.
+  char key[128];
+  snprintf(key, sizeof(key), "rgbmatrix-pixel-mapping 1 %dx%d %016llx "
+           "multiplexing=%d chain=%d parallel=%d mappers=",
+           shared_pixel_mapper_->width(), shared_pixel_mapper_->height(),
+           (unsigned long long)shared_pixel_mapper_->Checksum(),
+           params_.multiplexing, params_.chain_length, params_.parallel);
+  return std::string(key) + (params_.pixel_mapper_config
+                             ? params_.pixel_mapper_config : "") + "\n";
+}
+
+bool RGBMatrix::Impl::ReadPixelMappingCache(const std::string &key) {
+  FILE *in = fopen(params_.pixel_mapping_cache, "rb");
+  if (in == NULL) return false;
+  std::string file_key(key.size(), '\0');
+  PixelDesignatorMap *panel_map = NULL;
+  PixelDesignatorMap *map = NULL;
+  // Until then, shared_pixel_mapper_ is the one the Framebuffer created,
+  // with all the GPIO words there are.
+  if (fread(&file_key[0], 1, key.size(), in) == key.size()
+      && file_key == key
+      && (panel_map = PixelDesignatorMap::Read(in, *shared_pixel_mapper_))
+      != NULL) {
+    map = PixelDesignatorMap::Read(in, *shared_pixel_mapper_);
+  }
+  fclose(in);
+  if (map == NULL) {
+    delete panel_map;
+    return false;  // Not there yet, or for something else.
+  }
+  delete shared_pixel_mapper_;
+  shared_pixel_mapper_ = map;
+  panel_pixel_mapper_ = panel_map;
+  return true;
+}
+
+void RGBMatrix::Impl::WritePixelMappingCache(const std::string &key) const {
+  // Replace the file at once, so it is never seen half written.
+  const std::string tmp_name = std::string(params_.pixel_mapping_cache)
+    + ".tmp";
+  FILE *out = fopen(tmp_name.c_str(), "wb");
+  bool success = (out != NULL
+                  && fwrite(key.data(), 1, key.size(), out) == key.size()
+                  && panel_pixel_mapper_->Write(out)
+                  && shared_pixel_mapper_->Write(out));
+  if (out != NULL && fclose(out) != 0) success = false;
+  if (!success
+      || rename(tmp_name.c_str(), params_.pixel_mapping_cache) != 0) {
+    fprintf(stderr, "Can't write pixel mapping cache %s: %s\n",
+            params_.pixel_mapping_cache, strerror(errno));
+    unlink(tmp_name.c_str());
+  }
 }
 
 RGBMatrix::Impl::~Impl() {
@@ -405,6 +597,9 @@ RGBMatrix::Impl::~Impl() {
     delete created_frames_[i];
   }
   delete shared_pixel_mapper_;
+  delete panel_pixel_mapper_;
+  delete pending_pixel_mapper_;
+  delete retired_pixel_mapper_;
 }
 
 RGBMatrix::~RGBMatrix() {
@@ -425,10 +620,12 @@ void RGBMatrix::Impl::OutputGPIO(uint64_t output_bits) {
   io_->WriteMaskedBits(output_bits, user_output_bits_);
 }
 
-void RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
-                                             int chain, int parallel) {
+bool RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
+                                             int chain, int parallel,
+                                             PixelDesignatorMap **map) {
   if (pixel_mapper_config == NULL || strlen(pixel_mapper_config) == 0)
-    return;
+    return true;
+  bool success = true;
   char *const writeable_copy = strdup(pixel_mapper_config);
   const char *const end = writeable_copy + strlen(writeable_copy);
   char *s = writeable_copy;
@@ -443,11 +640,20 @@ void RGBMatrix::Impl::ApplyNamedPixelMappers(const char *pixel_mapper_config,
       fprintf(stderr, "Stray parameter ':%s' without mapper name ?\n", optional_param_start);
     }
     if (*s) {
-      ApplyPixelMapper(FindPixelMapper(s, chain, parallel, optional_param_start));
+      const PixelMapper *mapper = FindPixelMapper(s, chain, parallel,
+                                                  optional_param_start);
+      PixelDesignatorMap *new_map = mapper ? MapPixels(**map, mapper) : NULL;
+      if (new_map) {
+        delete *map;
+        *map = new_map;
+      } else {
+        success = false;
+      }
     }
     s = semicolon + 1;
   }
   free(writeable_copy);
+  return success;
 }
 
 void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
@@ -456,7 +662,7 @@ void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
     Framebuffer::InitGPIO(io_, params_.rows, params_.parallel,
                           !params_.disable_hardware_pulsing,
                           params_.pwm_lsb_nanoseconds, params_.pwm_dither_bits,
-                          params_.row_address_type);
+                          params_.row_address_type, params_.skip_reclock);
     Framebuffer::InitializePanels(io_, params_.panel_type,
                                   params_.cols * params_.chain_length);
   }
@@ -487,6 +693,7 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
     new FrameCanvas(new Framebuffer(params_.rows,
                                     params_.cols * params_.chain_length,
                                     params_.parallel,
+                                    bitplanes_,
                                     params_.scan_mode,
                                     params_.led_rgb_sequence,
                                     params_.inverse_colors,
@@ -510,7 +717,23 @@ FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
   if (!updater_) return NULL;
   FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction);
   if (other) active_ = other;
-  return previous;
+  UsePendingPixelMapper();
+  return other ? previous : active_;
+}
+
+FrameCanvas *RGBMatrix::Impl::TrySwap(FrameCanvas *other,
+                                      unsigned frame_fraction) {
+  if (frame_fraction == 0) frame_fraction = 1; // correct user error.
+  if (!updater_ || other == NULL) return NULL;
+  if (!has_spare_frame_) {
+    // The third frame; SwapOnVSync() alone does not need it.
+    updater_->AddSpareFrame(CreateFrameCanvas());
+    has_spare_frame_ = true;
+  }
+  FrameCanvas *const free_frame = updater_->TrySwap(other, frame_fraction);
+  active_ = other;
+  UsePendingPixelMapper();
+  return free_frame;
 }
 
 uint64_t RGBMatrix::Impl::AwaitInputChange(int timeout_ms) {
@@ -549,15 +772,23 @@ uint8_t RGBMatrix::Impl::brightness() {
 
 bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
   if (mapper == NULL) return true;
-  using internal::PixelDesignatorMap;
-  const int old_width = shared_pixel_mapper_->width();
-  const int old_height = shared_pixel_mapper_->height();
+  PixelDesignatorMap *new_mapper = MapPixels(*shared_pixel_mapper_, mapper);
+  if (new_mapper == NULL) return false;
+  delete shared_pixel_mapper_;
+  shared_pixel_mapper_ = new_mapper;
+  return true;
+}
+
+PixelDesignatorMap *RGBMatrix::Impl::MapPixels(const PixelDesignatorMap &map,
+                                               const PixelMapper *mapper) {
+  const int old_width = map.width();
+  const int old_height = map.height();
   int new_width, new_height;
   if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
-    return false;
+    return NULL;
   }
   PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
-    new_width, new_height, shared_pixel_mapper_->GetFillColorBits());
+    new_width, new_height, map);
   for (int y = 0; y < new_height; ++y) {
     for (int x = 0; x < new_width; ++x) {
       int orig_x = -1, orig_y = -1;
@@ -570,15 +801,39 @@ bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
         continue;
       }
       const internal::PixelDesignator *orig_designator;
-      orig_designator = shared_pixel_mapper_->get(orig_x, orig_y);
+      orig_designator = map.get(orig_x, orig_y);
       *new_mapper->get(x, y) = *orig_designator;
     }
   }
-  delete shared_pixel_mapper_;
-  shared_pixel_mapper_ = new_mapper;
+  return new_mapper;
+}
+
+bool RGBMatrix::Impl::SetPixelMappers(const char *pixel_mapper_config) {
+  MutexLock l(&set_pixel_mappers_sync_);
+  // Built here, so the refresh and SwapOnVSync() don't have to wait for it.
+  PixelDesignatorMap *map = new PixelDesignatorMap(*panel_pixel_mapper_);
+  if (!ApplyNamedPixelMappers(pixel_mapper_config,
+                              params_.chain_length, params_.parallel, &map)) {
+    delete map;
+    return false;
+  }
+  MutexLock pending_lock(&pending_pixel_mapper_sync_);
+  delete pending_pixel_mapper_;  // Never got used.
+  pending_pixel_mapper_ = map;
   return true;
 }
 
+void RGBMatrix::Impl::UsePendingPixelMapper() {
+  MutexLock l(&pending_pixel_mapper_sync_);
+  delete retired_pixel_mapper_;
+  retired_pixel_mapper_ = NULL;
+  if (pending_pixel_mapper_ == NULL) return;
+  // All FrameCanvases share the map, so this changes all of them at once.
+  retired_pixel_mapper_ = shared_pixel_mapper_;
+  shared_pixel_mapper_ = pending_pixel_mapper_;
+  pending_pixel_mapper_ = NULL;
+}
+
 // -- Public interface of RGBMatrix. Delegate everything to impl_
 
 static bool drop_privs(const char *priv_user, const char *priv_group) {
@@ -626,7 +881,8 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
 
   static GPIO io;  // This static var is a little bit icky.
   if (runtime_options.do_gpio_init
-      && !io.Init(runtime_options.gpio_slowdown)) {
+      && !io.Init(runtime_options.gpio_slowdown,
+                  runtime_options.gpio_backend)) {
     fprintf(stderr, "Must run as root to be able to access /dev/mem\n"
             "Prepend 'sudo' to the command\n");
     return NULL;
@@ -636,11 +892,11 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
     perror("Failed to become daemon");
   }
 
-  RGBMatrix::Impl *result = new RGBMatrix::Impl(NULL, options);
   // Allowing daemon also means we are allowed to start the thread now.
   const bool allow_daemon = !(runtime_options.daemon < 0);
-  if (runtime_options.do_gpio_init)
-    result->SetGPIO(&io, allow_daemon);
+  RGBMatrix::Impl *result
+    = new RGBMatrix::Impl(runtime_options.do_gpio_init ? &io : NULL, options,
+                          allow_daemon);
 
   // TODO(hzeller): if we disallow daemon, then we might also disallow
   // drop privileges: we can't drop privileges until we have created the
@@ -672,6 +928,11 @@ RGBMatrix *RGBMatrix::CreateFromFlags(int *argc, char ***argv,
 FrameCanvas *RGBMatrix::CreateFrameCanvas() {
   return impl_->CreateFrameCanvas();
 }
+FrameCanvas *RGBMatrix::TrySwap(FrameCanvas *other,
+                                unsigned framerate_fraction) {
+  return impl_->TrySwap(other, framerate_fraction);
+}
+
 FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned framerate_fraction) {
   return impl_->SwapOnVSync(other, framerate_fraction);
@@ -679,6 +940,9 @@ FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
 bool RGBMatrix::ApplyPixelMapper(const PixelMapper *mapper) {
   return impl_->ApplyPixelMapper(mapper);
 }
+bool RGBMatrix::SetPixelMappers(const char *pixel_mapper_config) {
+  return impl_->SetPixelMappers(pixel_mapper_config);
+}
 bool RGBMatrix::SetPWMBits(uint8_t value) { return impl_->SetPWMBits(value); }
 uint8_t RGBMatrix::pwmbits() { return impl_->pwmbits(); }
 
@@ -692,6 +956,13 @@ void RGBMatrix::SetBrightness(uint8_t brightness) {
 }
 uint8_t RGBMatrix::brightness() { return impl_->brightness(); }
 
+void RGBMatrix::SetRefreshBrightness(uint8_t brightness) {
+  Framebuffer::SetRefreshBrightness(brightness);
+}
+uint8_t RGBMatrix::refresh_brightness() {
+  return Framebuffer::refresh_brightness();
+}
+
 uint64_t RGBMatrix::RequestInputs(uint64_t all_interested_bits) {
   return impl_->RequestInputs(all_interested_bits);
 }
@@ -721,6 +992,11 @@ void RGBMatrix::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue)
   impl_->active_->SetPixel(x, y, red, green, blue);
 }
 
+void RGBMatrix::SetPixels(int x, int y, int width, int height,
+                          const uint8_t *image, size_t stride, bool is_bgr) {
+  impl_->active_->SetPixels(x, y, width, height, image, stride, is_bgr);
+}
+
 void RGBMatrix::Clear() {
   impl_->active_->Clear();
 }
@@ -737,6 +1013,11 @@ void FrameCanvas::SetPixel(int x, int y,
                          uint8_t red, uint8_t green, uint8_t blue) {
   frame_->SetPixel(x, y, red, green, blue);
 }
+void FrameCanvas::SetPixels(int x, int y, int width, int height,
+                            const uint8_t *image, size_t stride,
+                            bool is_bgr) {
+  frame_->SetPixels(x, y, width, height, image, stride, is_bgr);
+}
 void FrameCanvas::Clear() { return frame_->Clear(); }
 void FrameCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
   frame_->Fill(red, green, blue);
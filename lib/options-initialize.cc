@@ -23,12 +23,14 @@
 #include <grp.h>
 #include <pwd.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "multiplex-mappers-internal.h"
 #include "framebuffer-internal.h"
 
 #include "gpio.h"
+#include "rockchip-mapping.h"
 
 namespace rgb_matrix {
 RuntimeOptions::RuntimeOptions() :
@@ -39,7 +41,8 @@ RuntimeOptions::RuntimeOptions() :
 #endif
   daemon(0),            // Don't become a daemon by default.
   drop_privileges(1),   // Encourage good practice: drop privileges by default.
-  do_gpio_init(true)
+  do_gpio_init(true),
+  gpio_backend(NULL)    // Detect hardware.
 {
   // Nothing to see here.
 }
@@ -156,6 +159,9 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeStringFlag("panel-type", it, end,
                             &mopts->panel_type, &err))
         continue;
+      if (ConsumeStringFlag("pixel-mapping-cache", it, end,
+                            &mopts->pixel_mapping_cache, &err))
+        continue;
       if (ConsumeIntFlag("rows", it, end, &mopts->rows, &err))
         continue;
       if (ConsumeIntFlag("cols", it, end, &mopts->cols, &err))
@@ -188,6 +194,8 @@ static bool FlagInit(int &argc, char **&argv,
         continue;
       if (ConsumeBoolFlag("inverse", it, &mopts->inverse_colors))
         continue;
+      if (ConsumeBoolFlag("skip-reclock", it, &mopts->skip_reclock))
+        continue;
       // We don't have a swap_green_blue option anymore, but we simulate the
       // flag for a while.
       bool swap_green_blue;
@@ -217,6 +225,9 @@ static bool FlagInit(int &argc, char **&argv,
       //-- Runtime options.
       if (ConsumeIntFlag("slowdown-gpio", it, end, &ropts->gpio_slowdown, &err))
         continue;
+      if (ConsumeStringFlag("gpio-backend", it, end,
+                            &ropts->gpio_backend, &err))
+        continue;
       if (ropts->daemon >= 0 && ConsumeBoolFlag("daemon", it, &bool_scratch)) {
         ropts->daemon = bool_scratch ? 1 : 0;
         continue;
@@ -294,6 +305,8 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
 
   fprintf(out,
           "\t--led-gpio-mapping=<name> : Name of GPIO mapping used. Default \"%s\"\n"
+          "\t                            On Rockchip, also a pin spec or spec-file such as\n"
+          "\t                            \"output_enable=8_A4 clock=8_A6 strobe=8_A5 a=5_B0 ...\"\n"
           "\t--led-rows=<rows>         : Panel rows. Typically 8, 16, 32 or 64."
           " (Default: %d).\n"
           "\t--led-cols=<cols>         : Panel columns. Typically 32 or 64. "
@@ -303,12 +316,17 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "\t--led-parallel=<parallel> : Parallel chains. range=1..3 "
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
           "(6 for CM3) "
+          "(6 for Rockchip pin specs) "
+#else
+          "(4 for Rockchip pin specs) "
 #endif
           "(Default: %d).\n"
           "\t--led-multiplexing=<0..%d> : Mux type: 0=direct; %s (Default: 0)\n"
           "\t--led-pixel-mapper        : Semicolon-separated list of pixel-mappers to arrange pixels.\n"
           "\t                            Optional params after a colon e.g. \"U-mapper;Rotate:90\"\n"
           "\t                            Available: %s. Default: \"\"\n"
+          "\t--led-pixel-mapping-cache=<file> : Keep the pixel mapping in this file for a faster\n"
+          "\t                            start next time.\n"
           "\t--led-pwm-bits=<1..%d>    : PWM bits (Default: %d).\n"
           "\t--led-brightness=<percent>: Brightness in percent (Default: %d).\n"
           "\t--led-scan-mode=<0..1>    : 0 = progressive; 1 = interlaced "
@@ -320,6 +338,8 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "\t                            constant refresh rate on loaded system. 0=no limit. Default: %d\n"
           "\t--led-%sinverse             "
           ": Switch if your matrix has inverse colors %s.\n"
+          "\t--led-%sskip-reclock        : %slock in row data the panels "
+          "already have.\n"
           "\t--led-rgb-sequence        : Switch if your matrix has led colors "
           "swapped (Default: \"RGB\")\n"
           "\t--led-pwm-lsb-nanoseconds : PWM Nanoseconds for LSB "
@@ -332,11 +352,12 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           d.rows, d.cols, d.chain_length, d.parallel,
           (int) muxers.size(), CreateAvailableMultiplexString(muxers).c_str(),
           available_mappers.c_str(),
-          internal::Framebuffer::kBitPlanes, d.pwm_bits,
+          internal::Framebuffer::kMaxBitPlanes, d.pwm_bits,
           d.brightness, d.scan_mode,
           d.show_refresh_rate ? "no-" : "", d.show_refresh_rate ? "Don't s" : "S",
           d.limit_refresh_rate_hz,
           d.inverse_colors ? "no-" : "",    d.inverse_colors ? "off" : "on",
+          d.skip_reclock ? "no-" : "",      d.skip_reclock ? "Always c" : "Don't c",
           d.pwm_lsb_nanoseconds,
           !d.disable_hardware_pulsing ? "no-" : "",
           !d.disable_hardware_pulsing ? "Don't u" : "U");
@@ -344,6 +365,9 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
   fprintf(out, "\t--led-slowdown-gpio=<0..4>: "
           "Slowdown GPIO. Needed for faster Pis/slower panels "
           "(Default: %d).\n", r.gpio_slowdown);
+  fprintf(out, "\t--led-gpio-backend=<name> : GPIO hardware to use. One of %s "
+          "(Default: \"%s\").\n", GPIOBackend::AvailableNames(),
+          r.gpio_backend ? r.gpio_backend : "auto");
   if (r.daemon >= 0) {
     const bool on = (r.daemon > 0);
     fprintf(out,
@@ -399,12 +423,27 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
 #else
   const bool is_cm = false;
 #endif
-  if (parallel < 1 || parallel > (is_cm ? 6 : 3)) {
-    err->append("Parallel outside usable range (1..3 allowed"
+  // Rockchip pin specs can wire up more chains, as many as fit into
+  // gpio_bits_t with a bit for each signal: the 8 control and address lines,
+  // then 6 per chain. If the spec has pins for them is checked once the
+  // mapping is loaded.
+  const bool is_rockchip_spec = (hardware_mapping != NULL
+                                 && IsRockchipPinMappingSpec(hardware_mapping));
+  const int rockchip_spec_max_parallel
+    = std::min(6, (int)(8 * sizeof(gpio_bits_t) - 8) / 6);
+  const int max_parallel = (is_cm ? 6
+                            : is_rockchip_spec ? rockchip_spec_max_parallel
+                            : 3);
+  if (parallel < 1 || parallel > max_parallel) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "Parallel outside usable range (1..3 allowed"
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
-                ", up to 6 only for CM3"
+             ", up to 6 only for CM3"
 #endif
-                ").\n");
+             ", up to %d with Rockchip pin specs).\n",
+             rockchip_spec_max_parallel);
+    err->append(buffer);
     success = false;
   }
 
@@ -413,11 +452,11 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
-  if (pwm_bits <= 0 || pwm_bits > internal::Framebuffer::kBitPlanes) {
+  if (pwm_bits <= 0 || pwm_bits > internal::Framebuffer::kMaxBitPlanes) {
     char buffer[256];
     snprintf(buffer, sizeof(buffer),
              "Invalid range of pwm-bits (1..%d allowed).\n",
-             internal::Framebuffer::kBitPlanes);
+             internal::Framebuffer::kMaxBitPlanes);
     err->append(buffer);
     success = false;
   }
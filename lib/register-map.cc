@@ -0,0 +1,84 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "register-map.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <map>
+
+#define REGISTER_PAGE_SIZE 4096
+
+namespace rgb_matrix {
+namespace {
+typedef std::map<uint64_t, volatile uint32_t*> PageMap;
+
+// Keeping the file descriptor open allows to map pages even after we have
+// dropped privileges.
+static int s_mem_fd = -1;
+
+static PageMap *pages() {
+  static PageMap *pages = new PageMap();
+  return pages;
+}
+
+static bool OpenDevMemOnce() {
+  if (s_mem_fd >= 0) return true;
+  s_mem_fd = open("/dev/mem", O_RDWR|O_SYNC);
+  if (s_mem_fd < 0) {
+    perror("open /dev/mem");
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+volatile uint32_t *RegisterMap::Get(uint64_t physical_address) {
+  const uint64_t page = physical_address & ~(uint64_t)(REGISTER_PAGE_SIZE - 1);
+  const uint32_t offset = physical_address - page;
+
+  PageMap::const_iterator found = pages()->find(page);
+  if (found != pages()->end()) {
+    return found->second + offset / sizeof(uint32_t);
+  }
+
+  if (!OpenDevMemOnce())
+    return NULL;
+
+  void *result = mmap64(NULL,                    // Any address will do.
+                        REGISTER_PAGE_SIZE,
+                        PROT_READ|PROT_WRITE,    // r/w on registers.
+                        MAP_SHARED,
+                        s_mem_fd,
+                        page);
+  if (result == MAP_FAILED) {
+    perror("mmap error: ");
+    fprintf(stderr, "MMapping physical page 0x%llx\n",
+            (unsigned long long) page);
+    return NULL;
+  }
+  volatile uint32_t *const mapped = (volatile uint32_t*) result;
+  (*pages())[page] = mapped;
+  return mapped + offset / sizeof(uint32_t);
+}
+
+int RegisterMap::mapped_pages() {
+  return (int) pages()->size();
+}
+}  // namespace rgb_matrix
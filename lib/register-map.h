@@ -0,0 +1,60 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_REGISTER_MAP_H
+#define RPI_REGISTER_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace rgb_matrix {
+// Central place to access memory mapped hardware registers through /dev/mem.
+//
+// /dev/mem is opened once and kept open, and every physical page is mapped
+// read/write exactly once, no matter how many users (GPIO banks, clock
+// controller, timers) ask for registers in it. Mappings are never released;
+// they live as long as the process.
+class RegisterMap {
+public:
+  // Returns a pointer to the 32 bit register at the given physical address
+  // or NULL if it can't be mapped (typically: not running as root).
+  static volatile uint32_t *Get(uint64_t physical_address);
+
+  // Number of distinct pages mapped so far.
+  static int mapped_pages();
+};
+
+// A block of registers at a physical base address; offsets are in bytes as
+// found in the datasheets.
+class RegisterBlock {
+public:
+  RegisterBlock() : base_(NULL) {}
+
+  // Map the block. Returns 'false' if that failed.
+  bool Map(uint64_t physical_base) {
+    base_ = RegisterMap::Get(physical_base);
+    return base_ != NULL;
+  }
+  bool valid() const { return base_ != NULL; }
+
+  volatile uint32_t *reg(uint32_t byte_offset) const {
+    return base_ + byte_offset / sizeof(uint32_t);
+  }
+
+private:
+  volatile uint32_t *base_;
+};
+}  // namespace rgb_matrix
+
+#endif  // RPI_REGISTER_MAP_H
@@ -0,0 +1,284 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Lookup of Rockchip pin mappings and parsing of mapping specs given
+// with --led-gpio-mapping.
+
+#include "rockchip-mapping.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+namespace rgb_matrix {
+#define ROCKCHIP_SIGNAL(field) \
+  { #field, &HardwareMapping::field, &RockchipPinMapping::field }
+
+const RockchipSignal kRockchipSignals[] = {
+  ROCKCHIP_SIGNAL(output_enable),
+  ROCKCHIP_SIGNAL(clock),
+  ROCKCHIP_SIGNAL(strobe),
+
+  ROCKCHIP_SIGNAL(a), ROCKCHIP_SIGNAL(b), ROCKCHIP_SIGNAL(c),
+  ROCKCHIP_SIGNAL(d), ROCKCHIP_SIGNAL(e),
+
+  ROCKCHIP_SIGNAL(p0_r1), ROCKCHIP_SIGNAL(p0_g1), ROCKCHIP_SIGNAL(p0_b1),
+  ROCKCHIP_SIGNAL(p0_r2), ROCKCHIP_SIGNAL(p0_g2), ROCKCHIP_SIGNAL(p0_b2),
+
+  ROCKCHIP_SIGNAL(p1_r1), ROCKCHIP_SIGNAL(p1_g1), ROCKCHIP_SIGNAL(p1_b1),
+  ROCKCHIP_SIGNAL(p1_r2), ROCKCHIP_SIGNAL(p1_g2), ROCKCHIP_SIGNAL(p1_b2),
+
+  ROCKCHIP_SIGNAL(p2_r1), ROCKCHIP_SIGNAL(p2_g1), ROCKCHIP_SIGNAL(p2_b1),
+  ROCKCHIP_SIGNAL(p2_r2), ROCKCHIP_SIGNAL(p2_g2), ROCKCHIP_SIGNAL(p2_b2),
+
+  ROCKCHIP_SIGNAL(p3_r1), ROCKCHIP_SIGNAL(p3_g1), ROCKCHIP_SIGNAL(p3_b1),
+  ROCKCHIP_SIGNAL(p3_r2), ROCKCHIP_SIGNAL(p3_g2), ROCKCHIP_SIGNAL(p3_b2),
+
+  ROCKCHIP_SIGNAL(p4_r1), ROCKCHIP_SIGNAL(p4_g1), ROCKCHIP_SIGNAL(p4_b1),
+  ROCKCHIP_SIGNAL(p4_r2), ROCKCHIP_SIGNAL(p4_g2), ROCKCHIP_SIGNAL(p4_b2),
+
+  ROCKCHIP_SIGNAL(p5_r1), ROCKCHIP_SIGNAL(p5_g1), ROCKCHIP_SIGNAL(p5_b1),
+  ROCKCHIP_SIGNAL(p5_r2), ROCKCHIP_SIGNAL(p5_g2), ROCKCHIP_SIGNAL(p5_b2),
+};
+#undef ROCKCHIP_SIGNAL
+
+const int kRockchipSignalCount = sizeof(kRockchipSignals) / sizeof(kRockchipSignals[0]);
+
+// Mappings loaded from specs, with the HardwareMapping handed out for them.
+// Never freed, just like the compiled-in ones.
+struct LoadedMapping {
+  const HardwareMapping *hardware;
+  const RockchipPinMapping *pins;
+};
+static std::vector<LoadedMapping> s_loaded_mappings;
+
+static const RockchipPinMapping *FindCompiledInPinMapping(const char *name) {
+  for (RockchipPinMapping *it = rockchip_pin_mappings; it->name; ++it) {
+    if (strcasecmp(it->name, name) == 0)
+      return it;
+  }
+  return NULL;
+}
+
+const RockchipPinMapping *FindRockchipPinMapping(const char *name) {
+  const RockchipPinMapping *found = FindCompiledInPinMapping(name);
+  for (size_t i = 0; !found && i < s_loaded_mappings.size(); ++i) {
+    if (strcasecmp(s_loaded_mappings[i].pins->name, name) == 0)
+      found = s_loaded_mappings[i].pins;
+  }
+  return found;
+}
+
+const RockchipPinMapping *FindRockchipPinMapping(const HardwareMapping &h) {
+  for (size_t i = 0; i < s_loaded_mappings.size(); ++i) {
+    if (s_loaded_mappings[i].hardware == &h)
+      return s_loaded_mappings[i].pins;
+  }
+  return FindCompiledInPinMapping(h.name);
+}
+
+// Names of loaded mappings must not hide or shadow any other mapping.
+static bool IsMappingNameTaken(const char *name) {
+  for (HardwareMapping *it = matrix_hardware_mappings; it->name; ++it) {
+    if (strcasecmp(it->name, name) == 0)
+      return true;
+  }
+  return FindRockchipPinMapping(name) != NULL;
+}
+
+bool IsRockchipPinMappingSpec(const char *spec) {
+  return strchr(spec, '=') != NULL || access(spec, R_OK) == 0;
+}
+
+static bool ReadFileToString(const char *filename, std::string *out) {
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    perror(filename);
+    return false;
+  }
+  char buf[1024];
+  size_t r;
+  while ((r = fread(buf, 1, sizeof(buf), f)) > 0) {
+    out->append(buf, r);
+  }
+  fclose(f);
+  return true;
+}
+
+bool ParseRockchipPin(const char *str, rockchip_pin_t *pin) {
+  if (strncasecmp(str, "gpio", 4) == 0) str += 4;
+  char *end;
+  const long bank = strtol(str, &end, 10);
+  if (end == str || bank < 0 || bank > 127) return false;
+  long bit;
+  if (*end == '.') {
+    str = end + 1;
+    bit = strtol(str, &end, 10);
+    if (end == str || *end) return false;
+  } else if (*end == '_') {
+    const char port = toupper(end[1]);
+    if (port < 'A' || port > 'D') return false;
+    str = end + 2;
+    bit = strtol(str, &end, 10);
+    if (end == str || *end || bit > 7) return false;
+    bit += (port - 'A') * 8;
+  } else {
+    return false;
+  }
+  if (bit < 0 || bit > 31) return false;
+  *pin = ROCKCHIP_PIN_BANK_BIT(bank, bit);
+  return true;
+}
+
+static const RockchipSignal *FindSignal(const char *name) {
+  for (int i = 0; i < kRockchipSignalCount; ++i) {
+    if (strcasecmp(kRockchipSignals[i].name, name) == 0)
+      return &kRockchipSignals[i];
+  }
+  return NULL;
+}
+
+HardwareMapping *LoadRockchipPinMappingSpec(const char *spec) {
+  std::string text;
+  std::string name = "custom";
+  bool named = false;
+  if (strchr(spec, '=') != NULL) {
+    text = spec;
+  } else {
+    if (!ReadFileToString(spec, &text))
+      return NULL;
+    name = spec;
+  }
+
+  RockchipPinMapping pins;
+  memset(&pins, 0, sizeof(pins));
+  bool success = true;
+  const char *const kSeparators = " \t\r\n,;";
+  for (size_t pos = 0; pos < text.size(); /**/) {
+    if (text[pos] == '#') {
+      pos = text.find('\n', pos);
+      continue;
+    }
+    if (strchr(kSeparators, text[pos])) {
+      ++pos;
+      continue;
+    }
+    size_t end = text.find_first_of(kSeparators, pos);
+    if (end == std::string::npos) end = text.size();
+    const std::string token = text.substr(pos, end - pos);
+    pos = end;
+
+    const size_t eq = token.find('=');
+    if (eq == std::string::npos) {
+      fprintf(stderr, "Rockchip mapping: expected <signal>=<pin> in '%s'\n",
+              token.c_str());
+      success = false;
+      continue;
+    }
+    const std::string key = token.substr(0, eq);
+    const std::string value = token.substr(eq + 1);
+    if (key == "name") {
+      name = value;
+      named = true;
+      continue;
+    }
+    const RockchipSignal *signal = FindSignal(key.c_str());
+    if (signal == NULL) {
+      fprintf(stderr, "Rockchip mapping: unknown signal '%s'\n", key.c_str());
+      success = false;
+      continue;
+    }
+    rockchip_pin_t pin;
+    if (!ParseRockchipPin(value.c_str(), &pin)) {
+      fprintf(stderr, "Rockchip mapping: can't parse pin '%s' of %s; "
+              "expected something like GPIO7_C2 or 7.18\n",
+              value.c_str(), key.c_str());
+      success = false;
+      continue;
+    }
+    pins.*signal->pin = pin;
+  }
+
+  // Every pin can only be used once, and we need at least the basics.
+  for (int i = 0; i < kRockchipSignalCount; ++i) {
+    const rockchip_pin_t pin = pins.*kRockchipSignals[i].pin;
+    if (!ROCKCHIP_PIN_IS_CONNECTED(pin))
+      continue;
+    for (int j = i + 1; j < kRockchipSignalCount; ++j) {
+      if (pins.*kRockchipSignals[j].pin == pin) {
+        fprintf(stderr, "Rockchip mapping: %s and %s use the same pin.\n",
+                kRockchipSignals[i].name, kRockchipSignals[j].name);
+        success = false;
+      }
+    }
+  }
+  if (named && IsMappingNameTaken(name.c_str())) {
+    fprintf(stderr, "Rockchip mapping: there already is a mapping named "
+            "'%s'.\n", name.c_str());
+    success = false;
+  } else if (!named) {
+    // Each spec gets its own name, even if several are loaded.
+    const std::string base = name;
+    for (int n = 2; IsMappingNameTaken(name.c_str()); ++n) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "-%d", n);
+      name = base + suffix;
+    }
+  }
+  if (!ROCKCHIP_PIN_IS_CONNECTED(pins.output_enable)
+      || !ROCKCHIP_PIN_IS_CONNECTED(pins.clock)
+      || !ROCKCHIP_PIN_IS_CONNECTED(pins.strobe)) {
+    fprintf(stderr, "Rockchip mapping: output_enable, clock and strobe "
+            "are required.\n");
+    success = false;
+  }
+
+  // The framebuffer needs a bit for each signal; we just hand them out
+  // in order.
+  HardwareMapping *mapping = (HardwareMapping*) calloc(1, sizeof(HardwareMapping));
+  const int kAvailableBits = 8 * sizeof(gpio_bits_t);
+  int next_bit = 0;
+  for (int i = 0; success && i < kRockchipSignalCount; ++i) {
+    if (!ROCKCHIP_PIN_IS_CONNECTED(pins.*kRockchipSignals[i].pin))
+      continue;
+    if (next_bit == kAvailableBits) {
+      fprintf(stderr, "Rockchip mapping: more than %d signals don't fit "
+              "into the %d bit GPIO width.\n", kAvailableBits, kAvailableBits);
+      success = false;
+      break;
+    }
+    mapping->*kRockchipSignals[i].bits = (gpio_bits_t)1 << next_bit++;
+  }
+
+  if (!success) {
+    free(mapping);
+    return NULL;
+  }
+
+  RockchipPinMapping *registered = new RockchipPinMapping(pins);
+  registered->name = strdup(name.c_str());
+  const LoadedMapping loaded = { mapping, registered };
+  s_loaded_mappings.push_back(loaded);
+
+  mapping->name = registered->name;
+  mapping->max_parallel_chains = 0;  // Auto determine.
+  return mapping;
+}
+}  // namespace rgb_matrix
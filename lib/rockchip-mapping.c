@@ -0,0 +1,54 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http: *gnu.org/licenses/gpl-2.0.txt>
+ */
+
+/*
+ * We do this in plain C so that we can use designated initializers.
+ *
+ * Each entry gives the Rockchip pins for the HardwareMapping of the same
+ * name in hardware-mapping.c. Signals on the same bank can be written with
+ * a single store, so the fewer banks a mapping touches, the faster.
+ */
+#include "rockchip-mapping.h"
+
+struct RockchipPinMapping rockchip_pin_mappings[] = {
+  /*
+   * The 'regular' wiring of our RK3288 board. Colors all on GPIO7,
+   * clock, strobe and OE on GPIO8.
+   */
+  {
+    .name          = "regular",
+
+    .output_enable = ROCKCHIP_PIN(8, A, 4),
+    .clock         = ROCKCHIP_PIN(8, A, 6),
+    .strobe        = ROCKCHIP_PIN(8, A, 5),
+
+    /* Address lines */
+    .a             = ROCKCHIP_PIN(5, B, 0),
+    .b             = ROCKCHIP_PIN(5, B, 1),
+    .c             = ROCKCHIP_PIN(8, A, 7),
+    .d             = ROCKCHIP_PIN(8, B, 0),
+    .e             = ROCKCHIP_PIN(8, B, 1),
+
+    /* Parallel chain 0, RGB for both sub-panels */
+    .p0_r1         = ROCKCHIP_PIN(7, A, 6),
+    .p0_g1         = ROCKCHIP_PIN(7, A, 5),
+    .p0_b1         = ROCKCHIP_PIN(7, C, 2),
+    .p0_r2         = ROCKCHIP_PIN(7, C, 1),
+    .p0_g2         = ROCKCHIP_PIN(7, A, 2),
+    .p0_b2         = ROCKCHIP_PIN(7, A, 0),
+  },
+
+  {0}
+};
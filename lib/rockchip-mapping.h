@@ -0,0 +1,125 @@
+/* -*- mode: c; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation version 2.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http: *gnu.org/licenses/gpl-2.0.txt>
+ */
+#ifndef RPI_ROCKCHIP_MAPPING_H
+#define RPI_ROCKCHIP_MAPPING_H
+
+#include "gpio-bits.h"
+#include "hardware-mapping.h"
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A pin on a Rockchip SoC: GPIO bank and bit within the bank's 32 bit
+ * registers. Zero means 'not connected'.
+ */
+typedef uint16_t rockchip_pin_t;
+
+/* Pins as named in the datasheet, e.g. GPIO7_C2 is ROCKCHIP_PIN(7, C, 2) */
+#define ROCKCHIP_PORT_A 0
+#define ROCKCHIP_PORT_B 1
+#define ROCKCHIP_PORT_C 2
+#define ROCKCHIP_PORT_D 3
+#define ROCKCHIP_PIN(bank, port, n)                                     \
+  ((rockchip_pin_t)(0x8000 | ((bank) << 8) | (ROCKCHIP_PORT_##port * 8 + (n))))
+
+#define ROCKCHIP_PIN_BANK_BIT(bank, bit) ((rockchip_pin_t)(0x8000 | ((bank) << 8) | (bit)))
+#define ROCKCHIP_PIN_IS_CONNECTED(p) (((p) & 0x8000) != 0)
+#define ROCKCHIP_PIN_BANK(p)         (((p) >> 8) & 0x7f)
+#define ROCKCHIP_PIN_BIT(p)          ((p) & 0x1f)
+
+/*
+ * Where the signals of a HardwareMapping of the same name are wired to on the
+ * Rockchip. The HardwareMapping provides the bits the framebuffer works with,
+ * this provides the actual pins they are output on.
+ */
+struct RockchipPinMapping {
+  const char *name;
+
+  rockchip_pin_t output_enable;
+  rockchip_pin_t clock;
+  rockchip_pin_t strobe;
+
+  rockchip_pin_t a, b, c, d, e;
+
+  rockchip_pin_t p0_r1, p0_g1, p0_b1;
+  rockchip_pin_t p0_r2, p0_g2, p0_b2;
+
+  rockchip_pin_t p1_r1, p1_g1, p1_b1;
+  rockchip_pin_t p1_r2, p1_g2, p1_b2;
+
+  rockchip_pin_t p2_r1, p2_g1, p2_b1;
+  rockchip_pin_t p2_r2, p2_g2, p2_b2;
+
+  rockchip_pin_t p3_r1, p3_g1, p3_b1;
+  rockchip_pin_t p3_r2, p3_g2, p3_b2;
+
+  rockchip_pin_t p4_r1, p4_g1, p4_b1;
+  rockchip_pin_t p4_r2, p4_g2, p4_b2;
+
+  rockchip_pin_t p5_r1, p5_g1, p5_b1;
+  rockchip_pin_t p5_r2, p5_g2, p5_b2;
+};
+
+extern struct RockchipPinMapping rockchip_pin_mappings[];
+
+#ifdef  __cplusplus
+}  // extern C
+
+namespace rgb_matrix {
+// One signal of the panel interface, in both mappings.
+struct RockchipSignal {
+  const char *name;   // Field name, also used in mapping specs.
+  gpio_bits_t HardwareMapping::*bits;
+  rockchip_pin_t RockchipPinMapping::*pin;
+};
+extern const RockchipSignal kRockchipSignals[];
+extern const int kRockchipSignalCount;
+
+// Returns the pins for the mapping with the given name, or NULL. Also finds
+// mappings loaded with LoadRockchipPinMappingSpec().
+const RockchipPinMapping *FindRockchipPinMapping(const char *name);
+
+// Returns the pins for "h": those parsed along with it if it came from
+// LoadRockchipPinMappingSpec(), otherwise the compiled-in ones of the same
+// name. NULL if there are none.
+const RockchipPinMapping *FindRockchipPinMapping(const HardwareMapping &h);
+
+// Returns 'true' if "spec" is not the name of a mapping but a mapping spec
+// or the name of a file containing one.
+//
+// A spec is a list of <signal>=<pin>, separated by whitespace, ',' or ';',
+// with '#' starting a comment to the end of the line. Signals are named as
+// the fields of the HardwareMapping ("output_enable", "clock", "strobe",
+// "a".."e", "p0_r1".."p5_b2"), pins as in the datasheet ("GPIO7_C2" or
+// "7_C2") or as bank and bit ("7.18"). An optional "name=<name>" gives the
+// mapping a name, which must not be taken by any other mapping yet. Without
+// it, the mapping is named "custom" or after the file, made unique with a
+// numeric suffix.
+//   output_enable=8_A4 clock=8_A6 strobe=8_A5 a=5_B0 b=5_B1 c=8_A7 ...
+bool IsRockchipPinMappingSpec(const char *spec);
+
+// Parse a pin as written in mapping specs: "GPIO7_C2", "7_C2" or "7.18".
+bool ParseRockchipPin(const char *str, rockchip_pin_t *pin);
+
+// Parse the mapping spec and register the resulting RockchipPinMapping.
+// Returns a freshly allocated HardwareMapping of the same name, with a bit
+// for each connected signal; NULL on error (a message is printed to stderr).
+HardwareMapping *LoadRockchipPinMappingSpec(const char *spec);
+}  // namespace rgb_matrix
+#endif
+
+#endif
@@ -0,0 +1,357 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "rockchip-timing.h"
+#include "register-map.h"
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * nanosleep() takes longer than requested because of OS jitter.
+ * In about 99.9% of the cases, this is <= 25 microcseconds on
+ * the Raspberry Pi (empirically determined with a Raspbian kernel), so
+ * we substract this value whenever we do nanosleep(); the remaining time
+ * we then busy wait to get a good accurate result.
+ *
+ * The allowance per SoC is based on this, see kSoCTiming below. You can
+ * measure the overhead using DEBUG_SLEEP_JITTER.
+ *
+ * Note: A higher value here will result in more CPU use because of more busy
+ * waiting inching towards the real value (for all the cases that nanosleep()
+ * actually was better than this overhead).
+ */
+#define EMPIRICAL_NANOSLEEP_OVERHEAD_US 12
+
+/*
+ * Use nanosleep if we want to wait longer than these given microseconds
+ * beyond the jitter allowance. Below that, just use busy wait.
+ */
+#define MINIMUM_NANOSLEEP_TIME_US 5
+
+/*
+ * Waits shorter than this only use the calibrated busy loop: reading the
+ * clock would be a noticeable part of the wait.
+ */
+#define BUSY_LOOP_ONLY_NANOS 2000
+
+/* In order to determine useful values for above, set this to 1.
+ * It will output a histogram atexit() of how much how often we were over
+ * the requested time.
+ * (The full histogram will be shifted by the jitter allowance of the SoC.
+ *  To get a full histogram of OS overhead, set it to 0 first).
+ */
+#define DEBUG_SLEEP_JITTER 0
+
+// Registers of a Rockchip timer channel.
+#define ROCKCHIP_TIMER_LOAD_COUNT0     0x00
+#define ROCKCHIP_TIMER_LOAD_COUNT1     0x04
+#define ROCKCHIP_TIMER_CURRENT_VALUE0  0x08
+#define ROCKCHIP_TIMER_CURRENT_VALUE1  0x0C
+#define ROCKCHIP_TIMER_CONTROL         0x10
+#define ROCKCHIP_TIMER_ENABLE          (1 << 0)
+#define ROCKCHIP_TIMER_USER_MODE       (1 << 1)  // 0: free running
+
+namespace rgb_matrix {
+namespace {
+// Quad core SoCs: like on a multi-core Pi, we can afford to burn a bit more
+// busy wait to get the 99.999%-ile.
+static const RockchipSoCTiming kSoCTiming =
+#ifdef RK3399
+  { "rk3399", EMPIRICAL_NANOSLEEP_OVERHEAD_US + 10, 0 };
+#else
+  // TIMER7 in the alive power domain; not used by the kernel.
+  { "rk3288", EMPIRICAL_NANOSLEEP_OVERHEAD_US + 35, 0xFF810020 };
+#endif
+
+struct Clock {
+  const char *name;
+  uint64_t (*read)();   // Free running ticks.
+  uint64_t frequency;   // Ticks per second.
+};
+
+static Clock s_clock = { NULL, NULL, 0 };
+static uint64_t s_ticks_per_ns_q32 = 0;  // Ticks for a nanosecond; 32.32
+static uint64_t s_loops_per_ns_q16 = 0;  // Busy loops for a nanosecond; 16.16
+
+static uint64_t MonotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void SleepMicros(long micros) {
+  struct timespec sleep_time = { 0, micros * 1000 };
+  nanosleep(&sleep_time, NULL);
+}
+
+// Ticks per second of "read", measured against the system clock.
+static uint64_t MeasureFrequency(uint64_t (*read)()) {
+  const uint64_t start_nanos = MonotonicNanos();
+  const uint64_t start_ticks = read();
+  SleepMicros(10000);
+  const uint64_t ticks = read() - start_ticks;
+  const uint64_t nanos = MonotonicNanos() - start_nanos;
+  return ticks * 1000000000 / nanos;
+}
+
+// -- ARM generic timer.
+#if defined(__aarch64__)
+#  define HAS_ARM_GENERIC_TIMER 1
+static uint64_t ReadArmGenericTimer() {
+  uint64_t value;
+  asm volatile("isb; mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+}
+static uint64_t ArmGenericTimerFrequency() {
+  uint64_t value;
+  asm volatile("mrs %0, cntfrq_el0" : "=r"(value));
+  return value;
+}
+#elif defined(__arm__) && defined(__ARM_ARCH) && __ARM_ARCH >= 7
+#  define HAS_ARM_GENERIC_TIMER 1
+static uint64_t ReadArmGenericTimer() {
+  uint64_t value;
+  asm volatile("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r"(value));
+  return value;
+}
+static uint64_t ArmGenericTimerFrequency() {
+  uint32_t value;
+  asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(value));
+  return value;
+}
+#else
+#  define HAS_ARM_GENERIC_TIMER 0
+#endif
+
+#if HAS_ARM_GENERIC_TIMER
+static sigjmp_buf s_probe_jump;
+static void ProbeFailed(int) { siglongjmp(s_probe_jump, 1); }
+#endif
+
+// The kernel decides if user space may read the counter; if not (or if
+// there is no generic timer), reading it raises SIGILL.
+static bool ProbeArmGenericTimer(Clock *clock) {
+#if HAS_ARM_GENERIC_TIMER
+  struct sigaction probe, old;
+  memset(&probe, 0, sizeof(probe));
+  probe.sa_handler = ProbeFailed;
+  sigemptyset(&probe.sa_mask);
+  sigaction(SIGILL, &probe, &old);
+  uint64_t frequency = 0;
+  bool readable = false;
+  if (sigsetjmp(s_probe_jump, 1) == 0) {
+    frequency = ArmGenericTimerFrequency();
+    const uint64_t before = ReadArmGenericTimer();
+    SleepMicros(100);
+    readable = (ReadArmGenericTimer() != before);
+  }
+  sigaction(SIGILL, &old, NULL);
+  if (!readable)
+    return false;
+
+  // The frequency register is set up by the boot loader; trust, but verify.
+  const uint64_t measured = MeasureFrequency(ReadArmGenericTimer);
+  if (frequency < measured * 98 / 100 || frequency > measured * 102 / 100) {
+    fprintf(stderr, "ARM generic timer claims %llu Hz, but runs at about "
+            "%llu Hz. Using the latter.\n",
+            (unsigned long long)frequency, (unsigned long long)measured);
+    frequency = measured;
+  }
+  clock->name = "arm-generic-timer";
+  clock->read = ReadArmGenericTimer;
+  clock->frequency = frequency;
+  return true;
+#else
+  return false;
+#endif
+}
+
+// -- Rockchip timer channel.
+static rgb_matrix::RegisterBlock s_timer;
+static bool s_timer_counts_down = false;
+
+static uint64_t ReadRockchipTimerRaw() {
+  uint32_t high, low;
+  do {
+    high = *s_timer.reg(ROCKCHIP_TIMER_CURRENT_VALUE1);
+    low = *s_timer.reg(ROCKCHIP_TIMER_CURRENT_VALUE0);
+  } while (high != *s_timer.reg(ROCKCHIP_TIMER_CURRENT_VALUE1));
+  return ((uint64_t)high << 32) | low;
+}
+
+static uint64_t ReadRockchipTimer() {
+  const uint64_t value = ReadRockchipTimerRaw();
+  return s_timer_counts_down ? ~value : value;
+}
+
+static bool SetupRockchipTimer(uint64_t base, Clock *clock) {
+  if (base == 0 || !s_timer.Map(base))
+    return false;
+  volatile uint32_t *control = s_timer.reg(ROCKCHIP_TIMER_CONTROL);
+  if ((*control & ROCKCHIP_TIMER_ENABLE) == 0) {
+    // Unused: let it run free over the full range.
+    *s_timer.reg(ROCKCHIP_TIMER_LOAD_COUNT0) = 0xffffffff;
+    *s_timer.reg(ROCKCHIP_TIMER_LOAD_COUNT1) = 0xffffffff;
+    *control = ROCKCHIP_TIMER_ENABLE;
+  } else if ((*control & ROCKCHIP_TIMER_USER_MODE)
+             || *s_timer.reg(ROCKCHIP_TIMER_LOAD_COUNT0) != 0xffffffff
+             || *s_timer.reg(ROCKCHIP_TIMER_LOAD_COUNT1) != 0xffffffff) {
+    return false;  // Someone else uses it as a periodic timer.
+  }
+
+  // Depending on the SoC, these count up or down.
+  const uint64_t before = ReadRockchipTimerRaw();
+  SleepMicros(100);
+  const uint64_t after = ReadRockchipTimerRaw();
+  if (before == after)
+    return false;  // Not clocked.
+  s_timer_counts_down = (after < before);
+
+  clock->name = "rockchip-timer";
+  clock->read = ReadRockchipTimer;
+  clock->frequency = (MeasureFrequency(ReadRockchipTimer) + 500) / 1000 * 1000;
+  return true;
+}
+
+static void BusyLoop(uint64_t loops) {
+  for (uint64_t i = loops; i != 0; --i) {
+    asm("");
+  }
+}
+
+// Take the fastest of a few runs; the others were interrupted.
+static void CalibrateBusyLoop() {
+  const uint64_t kLoops = 100000;
+  uint64_t best_ticks = ~(uint64_t)0;
+  for (int i = 0; i < 5; ++i) {
+    const uint64_t start = s_clock.read();
+    BusyLoop(kLoops);
+    const uint64_t ticks = s_clock.read() - start;
+    if (ticks < best_ticks) best_ticks = ticks;
+  }
+  const uint64_t nanos = best_ticks * 1000000000 / s_clock.frequency;
+  s_loops_per_ns_q16 = (nanos > 0) ? (kLoops << 16) / nanos : (1 << 16);
+}
+
+#if DEBUG_SLEEP_JITTER
+static int overshoot_histogram_us[256] = {0};
+static void print_overshoot_histogram() {
+  fprintf(stderr, "Overshoot histogram >= jitter allowance of %dus\n"
+          "%6s | %7s | %7s\n",
+          kSoCTiming.jitter_allowance_us, "usec", "count", "accum");
+  int total_count = 0;
+  for (int i = 0; i < 256; ++i) total_count += overshoot_histogram_us[i];
+  int running_count = 0;
+  for (int us = 0; us < 256; ++us) {
+    const int count = overshoot_histogram_us[us];
+    if (count > 0) {
+      running_count += count;
+      fprintf(stderr, "%s%3dus: %8d %7.3f%%\n", (us == 0) ? "<=" : " +",
+              us, count, 100.0 * running_count / total_count);
+    }
+  }
+}
+#endif
+}  // namespace
+
+void RockchipTiming::Init() {
+  if (s_clock.read == NULL) {
+    if (!ProbeArmGenericTimer(&s_clock)
+        && !SetupRockchipTimer(kSoCTiming.timer_base, &s_clock)) {
+      s_clock.name = "clock_gettime";
+      s_clock.read = MonotonicNanos;
+      s_clock.frequency = 1000000000;
+    }
+    s_ticks_per_ns_q32 = (s_clock.frequency << 32) / 1000000000;
+#if DEBUG_SLEEP_JITTER
+    atexit(print_overshoot_histogram);
+#endif
+  }
+  // The CPU speed might have changed since last time.
+  CalibrateBusyLoop();
+}
+
+const RockchipSoCTiming &RockchipTiming::soc() { return kSoCTiming; }
+
+const char *RockchipTiming::clock_name() {
+  return s_clock.name ? s_clock.name : "none";
+}
+
+bool RockchipTiming::has_hardware_clock() {
+  return s_clock.read != NULL && s_clock.read != MonotonicNanos;
+}
+
+uint32_t RockchipTiming::MicrosecondCounter() {
+  if (s_clock.read == NULL)
+    return MonotonicNanos() / 1000;
+  const uint64_t ticks = s_clock.read();
+  const uint64_t frequency = s_clock.frequency;
+  return (ticks / frequency) * 1000000
+    + (ticks % frequency) * 1000000 / frequency;
+}
+
+uint64_t RockchipTiming::Ticks() {
+  return s_clock.read ? s_clock.read() : MonotonicNanos();
+}
+
+uint64_t RockchipTiming::NanosToTicks(long nanos) {
+  if (s_clock.read == NULL)
+    return nanos;
+  return (nanos * s_ticks_per_ns_q32) >> 32;
+}
+
+void RockchipTiming::SleepUntil(uint64_t deadline) {
+  const uint64_t now = Ticks();
+  if (now >= deadline)
+    return;
+
+  // For larger duration, we use nanosleep() to give the operating system
+  // a chance to do something else. It typically overshoots, so we sleep
+  // shorter by the jitter allowance and busy wait for the rest.
+  static const long kJitterAllowanceNanos
+    = kSoCTiming.jitter_allowance_us * 1000;
+  const uint64_t frequency = s_clock.read ? s_clock.frequency : 1000000000;
+  const long nanos = (deadline - now) * 1000000000 / frequency;
+  if (nanos > kJitterAllowanceNanos + MINIMUM_NANOSLEEP_TIME_US*1000) {
+    struct timespec sleep_time = { 0, nanos - kJitterAllowanceNanos };
+    nanosleep(&sleep_time, NULL);
+#if DEBUG_SLEEP_JITTER
+    const long slept_nanos = (Ticks() - now) * 1000000000 / frequency;
+    const long overshoot_us = (slept_nanos - sleep_time.tv_nsec) / 1000;
+    if (overshoot_us >= 0 && overshoot_us < 255)
+      overshoot_histogram_us[overshoot_us]++;
+    else
+      overshoot_histogram_us[255]++;
+#endif
+  }
+  while (Ticks() < deadline) {
+    // Busy wait for the rest.
+  }
+}
+
+void RockchipTiming::SleepNanos(long nanos) {
+  if (nanos <= 0)
+    return;
+  if (nanos < BUSY_LOOP_ONLY_NANOS || s_clock.read == NULL) {
+    BusyLoop((nanos * s_loops_per_ns_q16) >> 16);
+    return;
+  }
+  SleepUntil(s_clock.read() + NanosToTicks(nanos));
+}
+}  // namespace rgb_matrix
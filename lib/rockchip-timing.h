@@ -0,0 +1,70 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_ROCKCHIP_TIMING_H
+#define RPI_ROCKCHIP_TIMING_H
+
+#include <stdint.h>
+
+namespace rgb_matrix {
+// What we know about the timing behavior of a SoC.
+struct RockchipSoCTiming {
+  const char *name;
+  // How much longer than requested nanosleep() typically takes. We sleep
+  // that much shorter and busy wait for the rest.
+  int jitter_allowance_us;
+  // Physical address of a timer channel of the SoC we can use as clock if
+  // the ARM generic timer can't be read from user space; 0 if none.
+  uint64_t timer_base;
+};
+
+// Timing on Rockchip SoCs: a free running clock to measure time with and a
+// busy wait calibrated against it.
+//
+// The clock is the ARM generic timer if user space may read it, else a timer
+// channel of the SoC (needs /dev/mem), else clock_gettime().
+class RockchipTiming {
+public:
+  // Choose the clock and calibrate. Can be called more than once.
+  static void Init();
+
+  // The SoC we are compiled for.
+  static const RockchipSoCTiming &soc();
+
+  // Name of the clock in use, e.g. "arm-generic-timer".
+  static const char *clock_name();
+
+  // 'true' if we measure time with a hardware counter. If not, pulses
+  // are only as accurate as the operating system allows.
+  static bool has_hardware_clock();
+
+  // Rolling over microsecond counter.
+  static uint32_t MicrosecondCounter();
+
+  // The clock in ticks and the ticks of a duration. For deadlines.
+  static uint64_t Ticks();
+  static uint64_t NanosToTicks(long nanos);
+
+  // Wait until Ticks() reaches "deadline". Sleeps first if it is far enough
+  // away, like SleepNanos().
+  static void SleepUntil(uint64_t deadline);
+
+  // Wait "nanos" nanoseconds. Long waits sleep first, leaving the
+  // jitter allowance to a busy wait against the clock; short waits only use
+  // the calibrated busy loop.
+  static void SleepNanos(long nanos);
+};
+}  // namespace rgb_matrix
+
+#endif  // RPI_ROCKCHIP_TIMING_H
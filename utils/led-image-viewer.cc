@@ -97,19 +97,8 @@ static void StoreInStream(const cv::Mat &img, int delay_time_us,
   scratch->Clear();
   const int x_offset = do_center ? (scratch->width() - img.cols) / 2 : 0;
   const int y_offset = do_center ? (scratch->height() - img.rows) / 2 : 0;
-  for (size_t y = 0; y < img.rows; ++y) {
-    for (size_t x = 0; x < img.cols; ++x) {
-      char b = img.at<cv::Vec3b>(y,x)[0];
-      char g = img.at<cv::Vec3b>(y,x)[1];
-      char r = img.at<cv::Vec3b>(y,x)[2];
-      {
-        scratch->SetPixel(x + x_offset, y + y_offset,
-                          r,
-                          g,
-                          b);
-      }
-    }
-  }
+  scratch->SetPixels(x_offset, y_offset, img.cols, img.rows,
+                     img.data, img.step, true);  // OpenCV images are BGR.
   output->Stream(*scratch, delay_time_us);
 }
 
@@ -0,0 +1,551 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Run the refresh on the simulated GPIO backend, without any hardware.
+//
+// It first emulates the panels on the pins: the column shift registers and
+// their latch, the row address logic of each --led-row-addr-type and the
+// light each LED gives while output enable is on. That shows what changes
+// in the refresh do to the picture and to the number of clocks. Then it
+// times DumpToMatrix() and setting pixels.
+//
+// With -s, it instead swaps frames with a refresh thread, as programs do.
+
+#include "led-matrix.h"
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "gpio-simulated.h"
+#include "hardware-mapping.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+using namespace rgb_matrix;
+using rgb_matrix::internal::Framebuffer;
+using rgb_matrix::internal::PixelDesignatorMap;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Emulates the panels on the simulated GPIO backend and "
+          "benchmarks the refresh.\nDoesn't access any hardware.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr,
+          "\t-p <pattern>      : Picture to show: gradient, flat, random or "
+          "ramp (Default: gradient).\n"
+          "\t                    ramp shows red 0..255 and checks that it "
+          "gets brighter at\n"
+          "\t                    several refresh brightness levels.\n"
+          "\t-e <frames>       : Frames to emulate (Default: 4).\n"
+          "\t-n <frames>       : Frames to time (Default: 1000).\n"
+          "\t-B <percent>      : Refresh brightness (Default: 100).\n"
+          "\t-s                : Time swapping frames with a refresh thread "
+          "instead.\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  RuntimeOptions runtime;
+  runtime.daemon = -1;
+  runtime.drop_privileges = -1;
+  rgb_matrix::PrintMatrixFlags(stderr, RGBMatrix::Options(), runtime);
+  return 1;
+}
+
+static double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The start bits the refresh thread uses in a row of frames; see the
+// UpdateThread in led-matrix.cc.
+static int StartBit(int dither_bits, int frame) {
+  static const int kStartBits[3][4] = { {0, 0, 0, 0},
+                                        {0, 1, 0, 1},
+                                        {0, 1, 2, 2} };
+  return kStartBits[dither_bits][frame % 4];
+}
+
+// The simulated backend with panels attached. While emulating, every change
+// of the pins goes through the panel logic, which adds up the light of each
+// LED.
+class EmulatedPanels : public SimulatedGPIOBackend {
+public:
+  // Rows lit at the same time share the current of the column drivers, so
+  // the light is counted in 1/kShares nanoseconds: that divides evenly
+  // between up to 8 rows.
+  static const uint64_t kShares = 840;
+
+  EmulatedPanels() : h_(NULL), emulate_(false) {}
+
+  virtual bool SetHardwareMapping(const struct HardwareMapping &mapping) {
+    h_ = &mapping;
+    return true;
+  }
+
+  virtual void SetBits(gpio_bits_t value) {
+    const gpio_bits_t before = pins();
+    SimulatedGPIOBackend::SetBits(value);
+    if (emulate_) PinsChanged(before);
+  }
+  virtual void ClearBits(gpio_bits_t value) {
+    const gpio_bits_t before = pins();
+    SimulatedGPIOBackend::ClearBits(value);
+    if (emulate_) PinsChanged(before);
+  }
+  virtual void WriteMaskedBits(gpio_bits_t value, gpio_bits_t mask) {
+    const gpio_bits_t before = pins();
+    SimulatedGPIOBackend::WriteMaskedBits(value, mask);
+    if (emulate_) PinsChanged(before);
+  }
+
+  // Start emulating panels of "rows" x "columns", "parallel" chains of them.
+  void Emulate(int rows, int columns, int parallel, int row_address_type) {
+    rows_ = rows;
+    double_rows_ = rows / 2;
+    columns_ = columns;
+    parallel_ = parallel;
+    row_address_type_ = row_address_type;
+    shift_.assign(columns, 0);
+    latch_.assign(columns, 0);
+    shift_pos_ = 0;
+    row_shift_ = row_output_ = 0;
+    last_rows_ = 0;
+    const gpio_bits_t chain_bits[6][6] = {
+      { h_->p0_r1, h_->p0_g1, h_->p0_b1, h_->p0_r2, h_->p0_g2, h_->p0_b2 },
+      { h_->p1_r1, h_->p1_g1, h_->p1_b1, h_->p1_r2, h_->p1_g2, h_->p1_b2 },
+      { h_->p2_r1, h_->p2_g1, h_->p2_b1, h_->p2_r2, h_->p2_g2, h_->p2_b2 },
+      { h_->p3_r1, h_->p3_g1, h_->p3_b1, h_->p3_r2, h_->p3_g2, h_->p3_b2 },
+      { h_->p4_r1, h_->p4_g1, h_->p4_b1, h_->p4_r2, h_->p4_g2, h_->p4_b2 },
+      { h_->p5_r1, h_->p5_g1, h_->p5_b1, h_->p5_r2, h_->p5_g2, h_->p5_b2 },
+    };
+    memcpy(chain_bits_, chain_bits, sizeof(chain_bits_));
+    colors_ = 0;
+    for (int p = 0; p < parallel; ++p) {
+      for (int i = 0; i < 6; ++i) colors_ |= chain_bits_[p][i];
+    }
+    light_.assign(parallel * rows * columns * 3, 0);
+    data_clocks_ = row_clocks_ = row_changes_ = 0;
+    lit_ = false;
+    emulate_ = true;
+  }
+  void StopEmulation() { emulate_ = false; }
+  void ClearLight() { light_.assign(light_.size(), 0); }
+
+  // Light of "color" (0..2: red, green, blue) of the LED at x, y, with the
+  // parallel chains below each other. In 1/kShares nanoseconds.
+  uint64_t light(int x, int y, int color) const {
+    return light_[(y * columns_ + x) * 3 + color];
+  }
+  uint64_t LightChecksum() const {  // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < light_.size(); ++i) {
+      hash = (hash ^ light_[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
+  uint64_t data_clocks() const { return data_clocks_; }
+  uint64_t row_clocks() const { return row_clocks_; }
+  uint64_t row_changes() const { return row_changes_; }
+
+private:
+  void PinsChanged(gpio_bits_t before) {
+    const gpio_bits_t after = pins();
+    const gpio_bits_t rising = after & ~before;
+    const gpio_bits_t falling = before & ~after;
+    if (rising & h_->clock) {
+      shift_[shift_pos_] = after & colors_;
+      shift_pos_ = (shift_pos_ + 1) % columns_;
+      ++data_clocks_;
+    }
+    if (rising & h_->strobe) {
+      for (int c = 0; c < columns_; ++c) {
+        latch_[c] = shift_[(shift_pos_ + c) % columns_];
+      }
+    }
+    // Row address shift registers.
+    switch (row_address_type_) {
+    case 1:  // Clock A, data B; shows what it had before the clock.
+      if (rising & h_->a) ShiftRow((after & h_->b) != 0, true);
+      break;
+    case 3:  // Clock A on the falling edge, data C.
+      if (falling & h_->a) ShiftRow((after & h_->c) != 0, false);
+      break;
+    case 4:  // SM5266: clock A, data B while BK (C) is set.
+      if ((rising & h_->a) && (after & h_->c))
+        ShiftRow((after & h_->b) != 0, false);
+      break;
+    }
+    // Output enable is active low.
+    if (falling & h_->output_enable) {
+      lit_ = true;
+      lit_since_ = pulse_nanos();
+      const uint64_t rows = LitRows(after);
+      if (rows != last_rows_) ++row_changes_;
+      last_rows_ = rows;
+    }
+    if ((rising & h_->output_enable) && lit_) {
+      lit_ = false;
+      AddLight(LitRows(before), pulse_nanos() - lit_since_);
+    }
+  }
+
+  void ShiftRow(bool bit, bool delayed_output) {
+    if (delayed_output) row_output_ = row_shift_;
+    row_shift_ = (row_shift_ << 1) | (bit ? 1 : 0);
+    if (!delayed_output) row_output_ = row_shift_;
+    ++row_clocks_;
+  }
+
+  // The double-rows that light up with "pins", bit 0 being the first.
+  uint64_t LitRows(gpio_bits_t pins) const {
+    const uint64_t all = (1ULL << double_rows_) - 1;
+    switch (row_address_type_) {
+    case 1:  // The row with a low bit.
+      return ~row_output_ & all;
+    case 3:  // The row with a high bit.
+      return row_output_ & all;
+    case 2: {  // The line that is low, of A..D.
+      const gpio_bits_t lines[4] = { h_->a, h_->b, h_->c, h_->d };
+      uint64_t result = 0;
+      for (int i = 0; i < 4 && i < double_rows_; ++i) {
+        if (!(pins & lines[i])) result |= 1ULL << i;
+      }
+      return result;
+    }
+    case 4: {  // DE select the group of 8 rows, the shifter its rows.
+      int group = 0;
+      if (double_rows_ > 8 && (pins & h_->d)) group |= 1;
+      if (double_rows_ > 16 && (pins & h_->e)) group |= 2;
+      return ((row_output_ & 0xff) << (8 * group)) & all;
+    }
+    default: {  // Binary address on A..E.
+      int row = 0;
+      if (pins & h_->a) row |= 1;
+      if (double_rows_ > 2 && (pins & h_->b)) row |= 2;
+      if (double_rows_ > 4 && (pins & h_->c)) row |= 4;
+      if (double_rows_ > 8 && (pins & h_->d)) row |= 8;
+      if (double_rows_ > 16 && (pins & h_->e)) row |= 16;
+      return 1ULL << (row % double_rows_);
+    }
+    }
+  }
+
+  void AddLight(uint64_t rows, uint64_t nanos) {
+    if (rows == 0) return;
+    const uint64_t shares = nanos * kShares / __builtin_popcountll(rows);
+    for (int d = 0; d < double_rows_; ++d) {
+      if (!(rows & (1ULL << d))) continue;
+      for (int c = 0; c < columns_; ++c) {
+        const gpio_bits_t bits = latch_[c];
+        if (bits == 0) continue;
+        for (int p = 0; p < parallel_; ++p) {
+          for (int i = 0; i < 6; ++i) {
+            if (!(bits & chain_bits_[p][i])) continue;
+            const int y = p * rows_ + d + (i < 3 ? 0 : double_rows_);
+            light_[(y * columns_ + c) * 3 + i % 3] += shares;
+          }
+        }
+      }
+    }
+  }
+
+  const struct HardwareMapping *h_;
+  bool emulate_;
+
+  int rows_, double_rows_, columns_, parallel_;
+  int row_address_type_;
+  gpio_bits_t chain_bits_[6][6];
+  gpio_bits_t colors_;
+
+  std::vector<gpio_bits_t> shift_;  // Ring buffer, oldest at shift_pos_.
+  int shift_pos_;
+  std::vector<gpio_bits_t> latch_;
+  uint64_t row_shift_;
+  uint64_t row_output_;
+  uint64_t last_rows_;
+
+  bool lit_;
+  uint64_t lit_since_;
+  std::vector<uint64_t> light_;
+
+  uint64_t data_clocks_;
+  uint64_t row_clocks_;
+  uint64_t row_changes_;
+};
+
+static bool DrawPattern(const char *pattern, Framebuffer *fb) {
+  const int width = fb->width();
+  const int height = fb->height();
+  if (strcmp(pattern, "gradient") == 0) {
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        fb->SetPixel(x, y, 255 * x / width, 255 * y / height, 128);
+      }
+    }
+  } else if (strcmp(pattern, "flat") == 0) {
+    fb->Fill(255, 255, 255);
+  } else if (strcmp(pattern, "random") == 0) {
+    srandom(42);
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        fb->SetPixel(x, y, random() & 0xff, random() & 0xff, random() & 0xff);
+      }
+    }
+  } else if (strcmp(pattern, "ramp") == 0) {
+    if (width * height < 256) {
+      fprintf(stderr, "The ramp needs at least 256 pixels.\n");
+      return false;
+    }
+    fb->Clear();
+    for (int v = 0; v < 256; ++v) {
+      fb->SetPixel(v % width, v / width, v, 0, 0);
+    }
+  } else {
+    fprintf(stderr, "Unknown pattern '%s'\n", pattern);
+    return false;
+  }
+  return true;
+}
+
+// Show the ramp at several refresh brightness levels. Every value should
+// give more light than the one below.
+static void CheckRamp(Framebuffer *fb, GPIO *io, EmulatedPanels *panels,
+                      int dither_bits) {
+  static const int kLevels[] = { 100, 75, 50, 25, 10, 5, 1 };
+  const int width = fb->width();
+  printf("Ramp 0..255 over one dither cycle:\n");
+  for (size_t i = 0; i < sizeof(kLevels) / sizeof(kLevels[0]); ++i) {
+    Framebuffer::SetRefreshBrightness(kLevels[i]);
+    panels->ClearLight();
+    for (int frame = 0; frame < 4; ++frame) {
+      fb->DumpToMatrix(io, StartBit(dither_bits, frame));
+    }
+    int inverted = 0;
+    int distinct = 1;
+    uint64_t previous = 0;
+    for (int v = 0; v < 256; ++v) {
+      const uint64_t light = panels->light(v % width, v / width, 0);
+      if (v > 0 && light < previous) ++inverted;
+      if (v > 0 && light != previous) ++distinct;
+      previous = light;
+    }
+    printf("  brightness %3d%%: 255 lit %10.3f us, %3d distinct, "
+           "%3d inverted\n", kLevels[i],
+           panels->light(255 % width, 255 / width, 0)
+           / (1000.0 * EmulatedPanels::kShares),
+           distinct, inverted);
+  }
+}
+
+static void TimeSettingPixels(Framebuffer *fb) {
+  const int width = fb->width();
+  const int height = fb->height();
+
+  // Random pixels; positions and colors precomputed.
+  static const int kRandomPixels = 1 << 16;
+  std::vector<int> pos(kRandomPixels);
+  std::vector<uint8_t> color(kRandomPixels);
+  srandom(42);
+  for (int i = 0; i < kRandomPixels; ++i) {
+    pos[i] = random() % (width * height);
+    color[i] = random();
+  }
+  const int kRounds = 20;
+  double start = Now();
+  for (int r = 0; r < kRounds; ++r) {
+    for (int i = 0; i < kRandomPixels; ++i) {
+      const uint8_t c = color[i];
+      fb->SetPixel(pos[i] % width, pos[i] / width, c, c ^ 0x55, c ^ 0xaa);
+    }
+  }
+  const double random_ns = (Now() - start) * 1e9 / (kRounds * kRandomPixels);
+
+  // Whole frames.
+  std::vector<uint8_t> image(width * height * 3);
+  for (size_t i = 0; i < image.size(); ++i) image[i] = i * 7;
+  const int frames = std::max(1, (1 << 20) / (width * height));
+  start = Now();
+  for (int f = 0; f < frames; ++f) {
+    fb->SetPixels(0, 0, width, height, image.data(), width * 3, false);
+  }
+  const double frame_ns = (Now() - start) * 1e9 / (frames * width * height);
+
+  start = Now();
+  for (int f = 0; f < frames; ++f) {
+    fb->Fill(f, 255 - f, 128);
+  }
+  const double fill_us = (Now() - start) * 1e6 / frames;
+
+  printf("Setting pixels:\n"
+         "  SetPixel() at random   %8.1f ns/pixel\n"
+         "  SetPixels() whole frame%8.1f ns/pixel\n"
+         "  Fill()                 %8.1f us/frame\n",
+         random_ns, frame_ns, fill_us);
+}
+
+// Swap frames through the public API, with the refresh thread running on
+// the simulated backend.
+static int TimeSwapping(const RGBMatrix::Options &options,
+                        RuntimeOptions runtime) {
+  runtime.gpio_backend = "simulated";
+  runtime.daemon = 0;
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(options, runtime);
+  if (matrix == NULL) return 1;
+  FrameCanvas *canvas = matrix->CreateFrameCanvas();
+
+  const double kSeconds = 1.0;
+  int swaps = 0;
+  double start = Now();
+  while (Now() - start < kSeconds) {
+    canvas->Fill(swaps, 0, 0);
+    canvas = matrix->SwapOnVSync(canvas);
+    ++swaps;
+  }
+  printf("SwapOnVSync(): %8.1f frames/s\n", swaps / (Now() - start));
+
+  std::set<FrameCanvas*> canvases;
+  int tries = 0;
+  start = Now();
+  while (Now() - start < kSeconds) {
+    canvas->Fill(tries, 0, 0);
+    canvas = (tries % 16 == 15)
+      ? matrix->SwapOnVSync(canvas) : matrix->TrySwap(canvas);
+    canvases.insert(canvas);
+    ++tries;
+  }
+  printf("TrySwap():     %8.1f swaps/s, mixed with SwapOnVSync(); "
+         "%d canvases\n", tries / (Now() - start), (int)canvases.size());
+  delete matrix;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options options;
+  RuntimeOptions runtime;
+  runtime.daemon = -1;
+  runtime.drop_privileges = -1;
+  if (!ParseOptionsFromFlags(&argc, &argv, &options, &runtime)) {
+    return usage(argv[0]);
+  }
+
+  const char *pattern = "gradient";
+  int emulate_frames = 4;
+  int timed_frames = 1000;
+  int refresh_brightness = 100;
+  bool swap = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:e:n:B:s")) != -1) {
+    switch (opt) {
+    case 'p': pattern = optarg; break;
+    case 'e': emulate_frames = atoi(optarg); break;
+    case 'n': timed_frames = atoi(optarg); break;
+    case 'B': refresh_brightness = atoi(optarg); break;
+    case 's': swap = true; break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (emulate_frames < 0 || timed_frames < 1
+      || refresh_brightness < 1 || refresh_brightness > 100) {
+    fprintf(stderr, "Invalid number of frames or brightness.\n");
+    return usage(argv[0]);
+  }
+
+  if (swap)
+    return TimeSwapping(options, runtime);
+
+  if (options.multiplexing > 0 || options.pixel_mapper_config != NULL) {
+    fprintf(stderr, "Multiplexing and pixel mappers are not applied; rows "
+            "and columns are the ones the hardware sees.\n");
+  }
+
+  EmulatedPanels *panels = new EmulatedPanels();
+  GPIO io;
+  io.SetBackend(panels);
+  if (!io.Init(runtime.gpio_slowdown))
+    return 1;
+
+  // Set up like the RGBMatrix does.
+  const int columns = options.cols * options.chain_length;
+  Framebuffer::InitHardwareMapping(options.hardware_mapping);
+  Framebuffer::InitNativeLayout(&io, options.parallel);
+  PixelDesignatorMap *map = NULL;
+  Framebuffer fb(options.rows, columns, options.parallel, options.pwm_bits,
+                 options.scan_mode, options.led_rgb_sequence,
+                 options.inverse_colors, &map);
+  Framebuffer::InitGPIO(&io, options.rows, options.parallel,
+                        !options.disable_hardware_pulsing,
+                        options.pwm_lsb_nanoseconds, options.pwm_dither_bits,
+                        options.row_address_type, options.skip_reclock);
+  fb.SetBrightness(options.brightness);
+  Framebuffer::SetRefreshBrightness(refresh_brightness);
+  if (!DrawPattern(pattern, &fb))
+    return 1;
+
+  printf("%dx%d, %d parallel, %d bitplanes, row address type %d%s%s\n",
+         columns, options.rows, options.parallel, options.pwm_bits,
+         options.row_address_type,
+         options.scan_mode ? ", interlaced" : "",
+         options.skip_reclock ? ", skipping re-clocking" : "");
+
+  // From a fresh start, so clock counts can be compared between runs.
+  panels->Emulate(options.rows, columns, options.parallel,
+                  options.row_address_type);
+  for (int frame = 0; frame < emulate_frames; ++frame) {
+    fb.DumpToMatrix(&io, StartBit(options.pwm_dither_bits, frame));
+  }
+  printf("Emulated %d frames:\n"
+         "  %llu data clocks, %llu row clocks, %llu row changes\n"
+         "  panel output %016llx\n", emulate_frames,
+         (unsigned long long)panels->data_clocks(),
+         (unsigned long long)panels->row_clocks(),
+         (unsigned long long)panels->row_changes(),
+         (unsigned long long)panels->LightChecksum());
+  if (strcmp(pattern, "ramp") == 0) {
+    CheckRamp(&fb, &io, panels, options.pwm_dither_bits);
+    Framebuffer::SetRefreshBrightness(refresh_brightness);
+  }
+  panels->StopEmulation();
+
+  panels->ResetStatistics();
+  int saved_clockouts = 0;
+  const double start = Now();
+  for (int frame = 0; frame < timed_frames; ++frame) {
+    saved_clockouts += fb.DumpToMatrix(&io,
+                                       StartBit(options.pwm_dither_bits,
+                                                frame));
+  }
+  const double frame_us = (Now() - start) * 1e6 / timed_frames;
+  printf("DumpToMatrix(), average of %d frames:\n"
+         "  %8.1f us/frame\n"
+         "  %8.1f stores, %.1f clock edges, %.1f pulses per frame\n"
+         "  %8.1f us lit per frame, %.1f bitplanes not clocked in again\n",
+         timed_frames, frame_us,
+         (double)panels->stores() / timed_frames,
+         (double)panels->clock_edges() / timed_frames,
+         (double)panels->pulses() / timed_frames,
+         panels->pulse_nanos() / 1000.0 / timed_frames,
+         (double)saved_clockouts / timed_frames);
+
+  TimeSettingPixels(&fb);
+  return 0;
+}
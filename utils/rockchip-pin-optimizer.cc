@@ -0,0 +1,360 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Score Rockchip pin assignments by the number of register stores the
+// refresh needs, and suggest the best assignment for a set of free pins.
+//
+// The cost model follows the write path in lib/gpio_rk3288.cc; each bank
+// touched is one store (fewer if its content doesn't change):
+//  - clocking in a column stores every color bank without the clock, then
+//    the clock bank twice (data with clock low, rising edge).
+//  - each bitplane ends with clearing colors and clock, the strobe
+//    (set, clear) and the OE pulse (clear, set).
+//  - a row change writes the banks of the address lines.
+
+#include "rockchip-mapping.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+using namespace rgb_matrix;
+
+#define BANK_COUNT 9  // RK3288 GPIO0..GPIO8
+
+struct Geometry {
+  int parallel;
+  int rows;
+  int columns;
+  int pwm_bits;
+
+  int double_rows() const { return rows / 2; }
+  int address_lines() const {
+    int lines = 1;
+    while ((1 << lines) < double_rows()) ++lines;
+    return lines;
+  }
+};
+
+struct Score {
+  int per_column;
+  int per_pulse;
+  int per_row_change;
+  long per_frame;
+  int banks;        // Banks used overall.
+  bool native;      // All colors on one bank.
+};
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Counts the GPIO register stores a Rockchip pin "
+          "assignment needs for a refresh\nand suggests the best assignment "
+          "for the pins available on a board.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr,
+          "\t-m <mapping>      : Score this mapping; name or spec as given "
+          "to --led-gpio-mapping.\n"
+          "\t-p <pins>         : Suggest an assignment using these pins, e.g.\n"
+          "\t                    \"7_A0-7_A7,7_C0-7_C7,8_A0-8_B1\".\n"
+          "\t-P <parallel>     : Parallel chains (Default: 1).\n"
+          "\t-r <rows>         : Panel rows (Default: 32).\n"
+          "\t-c <columns>      : Columns clocked in per row; cols * chain "
+          "(Default: 32).\n"
+          "\t-b <pwm-bits>     : Bitplanes (Default: 11).\n");
+  return 1;
+}
+
+static int CountBits(uint32_t v) {
+  int result = 0;
+  for (/**/; v; v &= v - 1) ++result;
+  return result;
+}
+
+static uint32_t BankBit(rockchip_pin_t pin) {
+  return 1u << ROCKCHIP_PIN_BANK(pin);
+}
+
+static std::string PinName(rockchip_pin_t pin) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%d_%c%d", ROCKCHIP_PIN_BANK(pin),
+           'A' + ROCKCHIP_PIN_BIT(pin) / 8, ROCKCHIP_PIN_BIT(pin) % 8);
+  return buf;
+}
+
+// Is the signal needed for this geometry ?
+static bool IsUsed(const RockchipSignal &signal, const Geometry &g) {
+  const char *name = signal.name;
+  if (name[0] == 'p' && name[2] == '_')  // Colors: p<chain>_<color>
+    return name[1] - '0' < g.parallel;
+  if (name[1] == '\0')                   // Address lines a..e
+    return name[0] - 'a' < g.address_lines();
+  return true;
+}
+
+static bool IsColor(const RockchipSignal &signal) {
+  return signal.name[0] == 'p' && signal.name[2] == '_';
+}
+
+static bool IsAddress(const RockchipSignal &signal) {
+  return signal.name[1] == '\0';
+}
+
+static bool ScoreMapping(const RockchipPinMapping &m, const Geometry &g,
+                         Score *score) {
+  uint32_t colors = 0, address = 0, all = 0;
+  for (int i = 0; i < kRockchipSignalCount; ++i) {
+    const RockchipSignal &signal = kRockchipSignals[i];
+    if (!IsUsed(signal, g))
+      continue;
+    const rockchip_pin_t pin = m.*signal.pin;
+    if (!ROCKCHIP_PIN_IS_CONNECTED(pin)) {
+      fprintf(stderr, "Mapping '%s' has no pin for %s.\n",
+              m.name ? m.name : "", signal.name);
+      return false;
+    }
+    if (IsColor(signal)) colors |= BankBit(pin);
+    if (IsAddress(signal)) address |= BankBit(pin);
+    all |= BankBit(pin);
+  }
+  const uint32_t clock = BankBit(m.clock);
+
+  score->per_column = CountBits(colors & ~clock) + 2;
+  score->per_pulse = CountBits(colors | clock) + 2 + 2;
+  score->per_row_change = CountBits(address);
+  score->per_frame = (long)g.double_rows()
+    * ((long)g.pwm_bits * (g.columns * score->per_column + score->per_pulse)
+       + score->per_row_change);
+  score->banks = CountBits(all);
+  score->native = (CountBits(colors) == 1);
+  return true;
+}
+
+static void PrintScore(const Geometry &g, const Score &score) {
+  printf("  stores per column     : %d\n", score.per_column);
+  printf("  stores per OE pulse   : %d\n", score.per_pulse);
+  printf("  stores per row change : %d\n", score.per_row_change);
+  printf("  stores per frame      : %ld  (%d rows, %d columns, %d bitplanes)\n",
+         score.per_frame, g.rows, g.columns, g.pwm_bits);
+  printf("  banks used            : %d%s\n", score.banks,
+         score.native ? "; colors on one bank, no translation needed" : "");
+}
+
+static std::string SpecString(const RockchipPinMapping &m, const Geometry &g) {
+  std::string result;
+  for (int i = 0; i < kRockchipSignalCount; ++i) {
+    const RockchipSignal &signal = kRockchipSignals[i];
+    if (!IsUsed(signal, g))
+      continue;
+    if (!result.empty()) result.append(" ");
+    result.append(signal.name).append("=").append(PinName(m.*signal.pin));
+  }
+  return result;
+}
+
+// Parse a list of pins and ranges of pins within a bank, such as
+// "7_A0-7_A7,8_A4".
+static bool ParsePinList(const char *list, uint32_t available[BANK_COUNT]) {
+  std::string text(list);
+  for (size_t pos = 0; pos < text.size(); /**/) {
+    size_t end = text.find(',', pos);
+    if (end == std::string::npos) end = text.size();
+    const std::string item = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty()) continue;
+
+    const size_t dash = item.find('-');
+    rockchip_pin_t from, to;
+    if (!ParseRockchipPin(item.substr(0, dash).c_str(), &from)
+        || !ParseRockchipPin(dash == std::string::npos
+                             ? item.c_str()
+                             : item.substr(dash + 1).c_str(), &to)) {
+      fprintf(stderr, "Can't parse pin '%s'.\n", item.c_str());
+      return false;
+    }
+    if (ROCKCHIP_PIN_BANK(from) != ROCKCHIP_PIN_BANK(to)
+        || ROCKCHIP_PIN_BANK(from) >= BANK_COUNT
+        || ROCKCHIP_PIN_BIT(from) > ROCKCHIP_PIN_BIT(to)) {
+      fprintf(stderr, "'%s' is not a range within one of the %d banks.\n",
+              item.c_str(), BANK_COUNT);
+      return false;
+    }
+    for (int bit = ROCKCHIP_PIN_BIT(from); bit <= ROCKCHIP_PIN_BIT(to); ++bit)
+      available[ROCKCHIP_PIN_BANK(from)] |= 1u << bit;
+  }
+  return true;
+}
+
+// Take the lowest free pin of "bank", 0 if there is none.
+static rockchip_pin_t TakePin(uint32_t available[BANK_COUNT], int bank) {
+  for (int bit = 0; bit < 32; ++bit) {
+    if (available[bank] & (1u << bit)) {
+      available[bank] &= ~(1u << bit);
+      return ROCKCHIP_PIN_BANK_BIT(bank, bit);
+    }
+  }
+  return 0;
+}
+
+// Take a pin from "preferred", or else from the bank with the most free pins,
+// to keep the number of banks small.
+static rockchip_pin_t TakePinNear(uint32_t available[BANK_COUNT],
+                                  int preferred) {
+  if (preferred >= 0 && available[preferred])
+    return TakePin(available, preferred);
+  int best = -1;
+  for (int b = 0; b < BANK_COUNT; ++b) {
+    if (available[b] && (best < 0
+                         || CountBits(available[b]) > CountBits(available[best])))
+      best = b;
+  }
+  return best < 0 ? 0 : TakePin(available, best);
+}
+
+// Only the banks of colors, clock and address lines make a difference. For
+// every choice of clock bank, colors fill up the clock bank first, then the
+// banks with the most free pins; address lines go together as far as they
+// can. Strobe and OE cost the same anywhere, they go next to the clock.
+static bool Suggest(const uint32_t available_in[BANK_COUNT],
+                    const Geometry &g, RockchipPinMapping *best,
+                    Score *best_score) {
+  bool found = false;
+  for (int clock_bank = 0; clock_bank < BANK_COUNT; ++clock_bank) {
+    if (!available_in[clock_bank])
+      continue;
+    uint32_t available[BANK_COUNT];
+    memcpy(available, available_in, sizeof(available));
+    RockchipPinMapping m;
+    memset(&m, 0, sizeof(m));
+    m.name = "suggested";
+    m.clock = TakePin(available, clock_bank);
+
+    int color_bank = clock_bank;
+    for (int i = 0; i < kRockchipSignalCount; ++i) {
+      const RockchipSignal &signal = kRockchipSignals[i];
+      if (!IsColor(signal) || !IsUsed(signal, g))
+        continue;
+      m.*signal.pin = TakePinNear(available, color_bank);
+      color_bank = ROCKCHIP_PIN_BANK(m.*signal.pin);
+    }
+    int address_bank = -1;
+    for (int i = 0; i < kRockchipSignalCount; ++i) {
+      const RockchipSignal &signal = kRockchipSignals[i];
+      if (!IsAddress(signal) || !IsUsed(signal, g))
+        continue;
+      m.*signal.pin = TakePinNear(available, address_bank);
+      address_bank = ROCKCHIP_PIN_BANK(m.*signal.pin);
+    }
+    m.strobe = TakePinNear(available, clock_bank);
+    m.output_enable = TakePinNear(available, clock_bank);
+
+    bool complete = true;
+    for (int i = 0; i < kRockchipSignalCount; ++i) {
+      const RockchipSignal &signal = kRockchipSignals[i];
+      if (IsUsed(signal, g) && !ROCKCHIP_PIN_IS_CONNECTED(m.*signal.pin))
+        complete = false;
+    }
+    if (!complete)
+      continue;  // Not enough pins.
+
+    Score score;
+    if (!ScoreMapping(m, g, &score))
+      continue;
+    if (!found || score.per_frame < best_score->per_frame
+        || (score.per_frame == best_score->per_frame
+            && score.banks < best_score->banks)) {
+      *best = m;
+      *best_score = score;
+      found = true;
+    }
+  }
+  return found;
+}
+
+int main(int argc, char *argv[]) {
+  Geometry geometry;
+  geometry.parallel = 1;
+  geometry.rows = 32;
+  geometry.columns = 32;
+  geometry.pwm_bits = 11;
+
+  const char *mapping_name = NULL;
+  const char *pin_list = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "m:p:P:r:c:b:")) != -1) {
+    switch (opt) {
+    case 'm': mapping_name = optarg; break;
+    case 'p': pin_list = optarg; break;
+    case 'P': geometry.parallel = atoi(optarg); break;
+    case 'r': geometry.rows = atoi(optarg); break;
+    case 'c': geometry.columns = atoi(optarg); break;
+    case 'b': geometry.pwm_bits = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+
+  if (mapping_name == NULL && pin_list == NULL) {
+    fprintf(stderr, "Need a mapping to score (-m) or pins to choose from (-p)\n");
+    return usage(argv[0]);
+  }
+  if (geometry.parallel < 1 || geometry.parallel > 6
+      || geometry.rows < 4 || geometry.rows > 64 || geometry.rows % 2 != 0
+      || geometry.columns < 1 || geometry.pwm_bits < 1) {
+    fprintf(stderr, "Invalid geometry.\n");
+    return usage(argv[0]);
+  }
+
+  if (mapping_name) {
+    const RockchipPinMapping *pins = FindRockchipPinMapping(mapping_name);
+    if (pins == NULL && IsRockchipPinMappingSpec(mapping_name)) {
+      HardwareMapping *h = LoadRockchipPinMappingSpec(mapping_name);
+      if (h == NULL) return 1;  // Problem already reported.
+      pins = FindRockchipPinMapping(*h);
+    }
+    if (pins == NULL) {
+      fprintf(stderr, "There are no Rockchip pins for '%s'.\n", mapping_name);
+      return 1;
+    }
+    Score score;
+    if (!ScoreMapping(*pins, geometry, &score))
+      return 1;
+    printf("Mapping '%s', %d parallel chain%s:\n", pins->name,
+           geometry.parallel, geometry.parallel > 1 ? "s" : "");
+    PrintScore(geometry, score);
+  }
+
+  if (pin_list) {
+    uint32_t available[BANK_COUNT] = { 0 };
+    if (!ParsePinList(pin_list, available))
+      return 1;
+    RockchipPinMapping best;
+    Score score;
+    if (!Suggest(available, geometry, &best, &score)) {
+      fprintf(stderr, "Not enough pins for %d parallel chain%s and %d "
+              "address lines.\n", geometry.parallel,
+              geometry.parallel > 1 ? "s" : "", geometry.address_lines());
+      return 1;
+    }
+    if (mapping_name) printf("\n");
+    printf("Suggested for %d parallel chain%s:\n", geometry.parallel,
+           geometry.parallel > 1 ? "s" : "");
+    PrintScore(geometry, score);
+    printf("\n--led-gpio-mapping=\"%s\"\n", SpecString(best, geometry).c_str());
+  }
+  return 0;
+}
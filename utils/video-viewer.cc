@@ -59,18 +59,11 @@ static void InterruptHandler(int) {
   interrupt_received = true;
 }
 
-struct LedPixel {
-  uint8_t r, g, b;
-};
 void CopyFrame(AVFrame *pFrame, FrameCanvas *canvas,
                int offset_x, int offset_y,
                int width, int height) {
-  for (int y = 0; y < height; ++y) {
-    LedPixel *pix = (LedPixel*) (pFrame->data[0] + y*pFrame->linesize[0]);
-    for (int x = 0; x < width; ++x, ++pix) {
-      canvas->SetPixel(x + offset_x, y + offset_y, pix->r, pix->g, pix->b);
-    }
-  }
+  canvas->SetPixels(offset_x, offset_y, width, height,
+                    pFrame->data[0], pFrame->linesize[0], false);
 }
 
 // Scale "width" and "height" to fit within target rectangle of given size.